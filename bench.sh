@@ -0,0 +1,136 @@
+#!/bin/bash
+
+
+################## manual ###########################################
+# - launch script: "bash bench.sh [output prefix]"
+# -
+# - builds the three engines headless (one binary per frame behavior) and
+#   runs each of them over a matrix of grid sizes, thread counts, rules
+#   and frame behaviors, always with the same seed
+# - writes PREFIX.csv and PREFIX.json (default prefix: bench-<commit>, in
+#   this directory), one record per run: median and p99 generation time,
+#   generations/s, cell updates/s and scaling efficiency (throughput per
+#   thread, relative to the first thread count of the same configuration)
+# - version 2 has no generations: there, a "generation" is a sweep of
+#   rows x cols cell updates, wherever they land
+# - the matrix can be changed through the environment, e.g.
+#     ENGINES="1 3" SIZES="256x256" THREADS="1 2 4 8" RULES="1"
+#     FRAMES="dead random clipped wrap" GENERATIONS=200 V2_GENERATIONS=5 SEED=7
+#
+#
+####################################################################
+
+cd "$(dirname "$0")"
+
+ENGINES=${ENGINES:-"1 2 3"}
+SIZES=${SIZES:-"128x128 512x512"}
+THREADS=${THREADS:-"1 2 4"}
+RULES=${RULES:-"1 2 3 4"}
+# random borders make runs irreproducible, so they are left out by default
+FRAMES=${FRAMES:-"dead clipped wrap"}
+GENERATIONS=${GENERATIONS:-100}
+V2_GENERATIONS=${V2_GENERATIONS:-10}
+SEED=${SEED:-1}
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+PREFIX=${1:-bench-$COMMIT}
+
+BUILD=$(mktemp -d)
+trap "rm -rf $BUILD" EXIT
+
+frameNumber() {
+	case $1 in
+		dead) echo 0 ;;
+		random) echo 1 ;;
+		clipped) echo 2 ;;
+		wrap) echo 3 ;;
+		*) echo "unknown frame behavior $1" >&2; exit 1 ;;
+	esac
+}
+
+# compile the engines
+source version3/sources.sh
+for e in $ENGINES
+do
+	for f in $FRAMES
+	do
+		n=$(frameNumber $f) || exit 1
+		if [ $e = 3 ]
+		then
+			g++ -O2 -DHEADLESS -DFRAME_BEHAVIOR=$n $SOURCES -lm -lpthread -lrt -o $BUILD/cell$e-$f
+		else
+			g++ -O2 -DHEADLESS -DFRAME_BEHAVIOR=$n version$e/main.cpp -lm -lpthread -o $BUILD/cell$e-$f
+		fi
+		if [ ! -f $BUILD/cell$e-$f ]
+		then
+			exit 1
+		fi
+	done
+done
+echo "built the engines"
+
+echo "commit,engine,rows,cols,threads,rule,frame,seed,generations,elapsed_s,p50_ms,p99_ms,generations_per_s,cell_updates_per_s,efficiency" > $PREFIX.csv
+
+for e in $ENGINES
+do
+	g=$GENERATIONS
+	if [ $e = 2 ]
+	then
+		g=$V2_GENERATIONS
+	fi
+	for size in $SIZES
+	do
+		rows=${size%x*}
+		cols=${size#*x}
+		for rule in $RULES
+		do
+			for f in $FRAMES
+			do
+				base=""
+				for t in $THREADS
+				do
+					report=$($BUILD/cell$e-$f $rows $cols $t --generations $g --rule $rule --seed $SEED)
+					if [ $? -ne 0 ]
+					then
+						echo "v$e $size $t threads rule $rule $f: failed" >&2
+						continue
+					fi
+					# the report is "... elapsed E s R generations/s C cell updates/s p50-ms M p99-ms P",
+					# followed by the wait times on a line of their own
+					values=$(echo "$report" | awk '{
+						for (k = 1; k <= NF; k++) {
+							if ($k == "elapsed") elapsed = $(k+1)
+							if ($k == "generations/s") rate = $(k-1)
+							if ($k == "cell") cells = $(k-1)
+							if ($k == "p50-ms") p50 = $(k+1)
+							if ($k == "p99-ms") p99 = $(k+1)
+						}
+					}
+					END { print elapsed "," p50 "," p99 "," rate "," cells }')
+					rate=$(echo "$values" | cut -d, -f4)
+					if [ -z "$base" ]
+					then
+						base="$t $rate"
+					fi
+					efficiency=$(echo "$base $t $rate" | awk '{ printf "%.3f", ($2 > 0 ? ($4 / $3) / ($2 / $1) : 0) }')
+					echo "$COMMIT,$e,$rows,$cols,$t,$rule,$f,$SEED,$g,$values,$efficiency" >> $PREFIX.csv
+					echo "v$e ${rows}x$cols $t threads rule $rule $f: $rate generations/s, efficiency $efficiency"
+				done
+			done
+		done
+	done
+done
+
+# the same records as JSON
+awk -F, 'NR == 1 { for (k = 1; k <= NF; k++) name[k] = $k; print "["; next }
+	{
+		printf "%s  {", (NR > 2 ? ",\n" : "")
+		for (k = 1; k <= NF; k++) {
+			value = (name[k] == "commit" || name[k] == "frame") ? "\"" $k "\"" : $k
+			printf "%s\"%s\": %s", (k > 1 ? ", " : ""), name[k], value
+		}
+		printf "}"
+	}
+	END { print "\n]" }' $PREFIX.csv > $PREFIX.json
+
+echo "wrote $PREFIX.csv and $PREFIX.json"
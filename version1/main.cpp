@@ -38,7 +38,7 @@
  |																			|
  |		- '1' --> apply Rule 1 (Conway's classical Game of Life: B3/S23)	|
  |		- '2' --> apply Rule 2 (Coral: B3/S45678)							|
- |		- '3' --> apply Rule 3 (Amoeba: B357/S1358)							|
+ |		- '3' --> apply Rule 3 (Amoeba: B1358/S1358)						|
  |		- '4' --> apply Rule 4 (Maze: B3/S12345)							|
  |																			|
  +-------------------------------------------------------------------------*/
@@ -49,17 +49,36 @@
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 //
 #include "gl_frontEnd.h"
 
 //==================================================================================
 //	Custom data types
 //==================================================================================
+//	Wait times of a thread, in the buckets of version 3's MetricHistogram:
+//	bucket 0 counts the waits under 1 microsecond, bucket b those between
+//	2^((b-1)/4) and 2^(b/4) microseconds, and the last one everything
+//	above.  Only the thread itself adds to its histogram.
+#define METRIC_BUCKETS	96
+using MetricHistogram = struct {
+	std::atomic<unsigned long> counts[METRIC_BUCKETS];
+	std::atomic<unsigned long> sumNs;
+};
+
 using ThreadInfo = struct {
 	pthread_t id;
 	unsigned int index;
 	unsigned int startRow, endRow;
 	pthread_mutex_t lock;
+	//	time blocked on its lock, once per generation, less the leader's
+	//	sleep (the last thread to finish doesn't wait), and the time spent
+	//	computing bands
+	MetricHistogram waits;
+	std::atomic<unsigned long> computeNs;
 };
 
 
@@ -73,6 +92,14 @@ void* threadFunc(void*);
 void swapGrids(void);
 unsigned int cellNewState(unsigned int i, unsigned int j);
 void createThreads(void);
+double currentTime(void);
+void parseOptions(int argc, char** argv);
+void runHeadless(void);
+double stepPercentile(double q);
+void observeMetric(MetricHistogram* histogram, double seconds);
+double histogramPercentile(const unsigned long* counts, double q);
+double histogramMax(const unsigned long* counts);
+void reportWaits(FILE* out);
 
 //==================================================================================
 //	Precompiler #define to let us specify how things should be handled at the
@@ -84,16 +111,21 @@ void createThreads(void);
 #define FRAME_CLIPPED	2	//	same rule as elsewhere, with clipping to stay within bounds
 #define FRAME_WRAP		3	//	same rule as elsewhere, with wrapping around at edges
 
-//	Pick one value for FRAME_BEHAVIOR
+//	Pick one value for FRAME_BEHAVIOR (or define it when compiling, as the
+//	benchmark does: -DFRAME_BEHAVIOR=3)
+#ifndef FRAME_BEHAVIOR
 #define FRAME_BEHAVIOR	FRAME_DEAD
+#endif
 
 //==================================================================================
 //	Application-level global variables
 //==================================================================================
 
 //	Don't touch
+#ifndef HEADLESS
 extern int GRID_PANE, STATE_PANE;
 extern int gMainWindow, gSubwindow[2];
+#endif
 
 //	The state grid and its dimensions.  We now have two copies of the grid:
 //		- currentGrid is the one displayed in the graphic front end
@@ -123,6 +155,31 @@ int generation = 0;
 unsigned int threadsDoneCount = 0;
 pthread_mutex_t threadCountLock;
 
+//	Headless mode (for the benchmark, see ../bench.sh): no window, the
+//	workers run flat out for maxGenerations generations, then the
+//	throughput and the generation times are reported.  A build with
+//	HEADLESS defined does not use (nor link) GL/glut at all.
+#ifdef HEADLESS
+bool headless = true;
+#else
+bool headless = false;
+#endif
+unsigned int maxGenerations = 0;
+unsigned int seed = 0;
+bool runFinished = false;
+pthread_mutex_t runFinishedLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t runFinishedCond = PTHREAD_COND_INITIALIZER;
+
+//	Time from the release of the workers to the arrival of the last one,
+//	for each generation of a run with a fixed length
+double* stepTimes = nullptr;
+unsigned int numStepTimes = 0;
+double generationStart = 0.;
+
+//	How long the last thread to finish a generation slept (the speed
+//	setting) before releasing the others, which don't count it as waiting
+double throttleTime = 0.;
+
 //==================================================================================
 //	These are the functions that tie the simulation with the rendering.
 //	Some parts are "don't touch."  Other parts need your intervention
@@ -130,6 +187,7 @@ pthread_mutex_t threadCountLock;
 //==================================================================================
 
 
+#ifndef HEADLESS
 void displayGridPane(void)
 {
 	//	This is OpenGL/glut magic.  Don't touch
@@ -169,21 +227,34 @@ void displayStatePane(void)
 	glutSwapBuffers();
 	glutSetWindow(gMainWindow);
 }
+#endif
 
 //------------------------------------------------------------------------
 //	You shouldn't have to change anything in the main function
 //------------------------------------------------------------------------
 int main(int argc, char** argv) {
-	if (argc != 4) {
+	if (argc < 4) {
 		fprintf(stderr, "cell program launched with incorrect number of arguments.\n"
-			"Proper usage: ./cell [number of rows] [number of cols] [max number of live threads]\n"
-			"Suggested values: rows: 400, cols: 420, threads: 10\n");
+			"Proper usage: ./cell [number of rows] [number of cols] [max number of live threads] [options]\n"
+			"Suggested values: rows: 400, cols: 420, threads: 10\n"
+			"Options:\n"
+			"    --headless               no window: run, then report the throughput\n"
+			"    --generations G          stop after G generations\n"
+			"    --rule R                 start with rule R (1 to 4)\n"
+			"    --seed S                 seed of the random generator\n");
 		exit(1);
 	}
 	numRows = (unsigned int)strtoul(argv[1], NULL, 10);
 	numCols = (unsigned int)strtoul(argv[2], NULL, 10);
 	maxNumThreads = (unsigned int)strtoul(argv[3], NULL, 10);
+	parseOptions(argc, argv);
 
+	if (headless) {
+		initializeApplication();
+		runHeadless();
+	}
+
+#ifndef HEADLESS
 	//	This takes care of initializing glut and the GUI.
 	//	You shouldn’t have to touch this
 	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
@@ -198,6 +269,7 @@ int main(int argc, char** argv) {
 	//	we set up earlier will be called when the corresponding event
 	//	occurs
 	glutMainLoop();
+#endif
 	
 	//	This will never be executed (the exit point will be in one of the
 	//	call back functions).
@@ -224,6 +296,7 @@ void cleanupAndQuit(void)
 	delete []currentGrid;
 	delete []nextGrid;
 
+	reportWaits(stdout);
 	exit(0);
 }
 
@@ -250,7 +323,7 @@ void initializeApplication(void)
 	//	simulation), only some color, in meant-to-be-thrown-away code
 	
 	//	seed the pseudo-random generator
-	srand((unsigned int) time(NULL));
+	srand(seed != 0 ? seed : (unsigned int) time(NULL));
 	
 	resetGrid();
 }
@@ -265,6 +338,7 @@ void* threadFunc(void* arg)
 	
 	bool keepGoing = true;
 	while (keepGoing) {
+		double startTime = currentTime();
 		//std::cout << "startrow: " << info << std::endl;
 		for (unsigned int i = info->startRow; i <= info->endRow; i++)
 		{
@@ -289,6 +363,8 @@ void* threadFunc(void* arg)
 				}
 			}
 		}
+		double bandEnd = currentTime();
+		info->computeNs.fetch_add((unsigned long) (1e9 * (bandEnd - startTime)), std::memory_order_relaxed);
 		// I am done for this generation
 		pthread_mutex_lock(&threadCountLock);
 		threadsDoneCount++;
@@ -297,13 +373,30 @@ void* threadFunc(void* arg)
 		if (threadsDoneCount == maxNumThreads) {
 			pthread_mutex_unlock(&threadCountLock);
 			// Can only be done by the last thread to finish its load
+			if (stepTimes != nullptr && numStepTimes < maxGenerations)
+				stepTimes[numStepTimes++] = currentTime() - generationStart;
 			swapGrids();
-			usleep(speed);
+			throttleTime = 0.;
+			if (speed > 0) {
+				double sleepStart = currentTime();
+				usleep(speed);
+				throttleTime = currentTime() - sleepStart;
+			}
 			threadsDoneCount = 0;
 			generation++;  //? not T 04:42
 			//threadsDoneCount = 0; // reset to 0 ????
 
+			//	End of the run: don't wake anybody up
+			if (maxGenerations > 0 && (unsigned int) generation >= maxGenerations) {
+				pthread_mutex_lock(&runFinishedLock);
+				runFinished = true;
+				pthread_cond_signal(&runFinishedCond);
+				pthread_mutex_unlock(&runFinishedLock);
+				pthread_mutex_lock(&(info->lock));
+			}
+
 			// wake up the other threads
+			generationStart = currentTime();
 			for (unsigned int k = 0; k < maxNumThreads; k++) {
 				if (k != info->index)
 					pthread_mutex_unlock(&(threadInfo[k].lock));
@@ -312,7 +405,11 @@ void* threadFunc(void* arg)
 		else {
 			pthread_mutex_unlock(&threadCountLock);
 			// and wait for the rest of the threads to finish
+			double waitStart = currentTime();
 			pthread_mutex_lock(&(info->lock));
+			//	the leader's sleep only reflects the speed setting
+			double wait = currentTime() - waitStart - throttleTime;
+			observeMetric(&info->waits, wait > 0. ? wait : 0.);
 		}
 	}
 	return nullptr;
@@ -388,40 +485,40 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 					count++;
 				if (currentGrid[i-1][j] != 0)
 					count++;
-				if (j<NUM_COLS-1 && currentGrid[i-1][j+1] != 0)
+				if (j<numCols-1 && currentGrid[i-1][j+1] != 0)
 					count++;
 			}
 
 			if (j>0 && currentGrid[i][j-1] != 0)
 				count++;
-			if (j<NUM_COLS-1 && currentGrid[i][j+1] != 0)
+			if (j<numCols-1 && currentGrid[i][j+1] != 0)
 				count++;
 
-			if (i<NUM_ROWS-1)
+			if (i<numRows-1)
 			{
 				if (j>0 && currentGrid[i+1][j-1] != 0)
 					count++;
 				if (currentGrid[i+1][j] != 0)
 					count++;
-				if (j<NUM_COLS-1 && currentGrid[i+1][j+1] != 0)
+				if (j<numCols-1 && currentGrid[i+1][j+1] != 0)
 					count++;
 			}
 			
 	
-		#elif FRAME_BEHAVIOR == FRAME_WRAPPED
+		#elif FRAME_BEHAVIOR == FRAME_WRAP
 	
-			unsigned int 	iM1 = (i+NUM_ROWS-1)%NUM_ROWS,
-							iP1 = (i+1)%NUM_ROWS,
-							jM1 = (j+NUM_COLS-1)%NUM_COLS,
-							jP1 = (j+1)%NUM_COLS;
-			count = currentGrid[iM1][jM1] != 0 +
-					currentGrid[iM1][j] != 0 +
-					currentGrid[iM1][jP1] != 0  +
-					currentGrid[i][jM1] != 0  +
-					currentGrid[i][jP1] != 0  +
-					currentGrid[iP1][jM1] != 0  +
-					currentGrid[iP1][j] != 0  +
-					currentGrid[iP1][jP1] != 0 ;
+			unsigned int 	iM1 = (i+numRows-1)%numRows,
+							iP1 = (i+1)%numRows,
+							jM1 = (j+numCols-1)%numCols,
+							jP1 = (j+1)%numCols;
+			count = (currentGrid[iM1][jM1] != 0) +
+					(currentGrid[iM1][j] != 0) +
+					(currentGrid[iM1][jP1] != 0)  +
+					(currentGrid[i][jM1] != 0)  +
+					(currentGrid[i][jP1] != 0)  +
+					(currentGrid[iP1][jM1] != 0)  +
+					(currentGrid[iP1][j] != 0)  +
+					(currentGrid[iP1][jP1] != 0);
 
 		#else
 			#error undefined frame behavior
@@ -472,7 +569,7 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 			}
 			break;
 			
-		//	Rule 3 (Amoeba: B357/S1358)
+		//	Rule 3 (Amoeba: B1358/S1358)
 		case AMOEBA_RULE:
 
 			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
@@ -526,6 +623,10 @@ void createThreads(void) {
 	unsigned int startRow = 0;
 	for (unsigned int k = 0; k < maxNumThreads; k++) {
 		threadInfo[k].index = k;
+		for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+			threadInfo[k].waits.counts[b] = 0;
+		threadInfo[k].waits.sumNs = 0;
+		threadInfo[k].computeNs = 0;
 		
 		unsigned int endRow = k < m ? startRow + p : startRow + p - 1;
 
@@ -539,6 +640,7 @@ void createThreads(void) {
 		pthread_mutex_lock(&(threadInfo[k].lock));
 	}
 
+	generationStart = currentTime();
 	for (unsigned int k = 0; k < maxNumThreads; k++) {
 		// create thread k
 		int error_code = pthread_create(&(threadInfo[k].id),	// ptr to pthread_t
@@ -549,4 +651,136 @@ void createThreads(void) {
 			std::cerr << "ERROR: Failed to create ghost thread with error code " << error_code << std::endl;
 		else numLiveThreads++;  // increment counter to display on GUI
 	}
-}
\ No newline at end of file
+}
+
+//	Options that follow the three numbers of the command line
+void parseOptions(int argc, char** argv) {
+	for (int k = 4; k < argc; k++) {
+		if (!strcmp(argv[k], "--headless"))
+			headless = true;
+		else if (!strcmp(argv[k], "--generations") && k + 1 < argc)
+			maxGenerations = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--rule") && k + 1 < argc) {
+			rule = (unsigned int)strtoul(argv[++k], NULL, 10);
+			if (rule < GAME_OF_LIFE_RULE || rule > MAZE_RULE) {
+				fprintf(stderr, "Invalid rule number\n");
+				exit(1);
+			}
+		}
+		else if (!strcmp(argv[k], "--seed") && k + 1 < argc)
+			seed = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else {
+			fprintf(stderr, "Unknown or incomplete option %s\n", argv[k]);
+			exit(1);
+		}
+	}
+	if (headless && maxGenerations == 0) {
+		fprintf(stderr, "a headless run needs --generations\n");
+		exit(1);
+	}
+}
+
+//	Same report as version 3's headless runs, so that bench.sh can
+//	compare the engines
+void runHeadless(void) {
+	//	no point in slowing down the simulation
+	speed = 0;
+	stepTimes = new double[maxGenerations];
+
+	double startTime = currentTime();
+	createThreads();
+	pthread_mutex_lock(&runFinishedLock);
+	while (!runFinished)
+		pthread_cond_wait(&runFinishedCond, &runFinishedLock);
+	pthread_mutex_unlock(&runFinishedLock);
+	double elapsed = currentTime() - startTime;
+
+	unsigned long population = 0;
+	for (unsigned int i = 0; i < numRows; i++)
+		for (unsigned int j = 0; j < numCols; j++)
+			population += currentGrid[i][j] != 0;
+	double cellUpdates = (double) generation * numRows * numCols;
+	printf("rows 0-%u generation %d population %lu elapsed %.3f s %.1f generations/s %.0f cell updates/s"
+		   " p50-ms %.3f p99-ms %.3f\n",
+		   numRows - 1, generation, population, elapsed,
+		   elapsed > 0. ? generation / elapsed : 0., elapsed > 0. ? cellUpdates / elapsed : 0.,
+		   stepPercentile(0.50), stepPercentile(0.99));
+	cleanupAndQuit();
+}
+
+//	Generation time (in ms) below which a fraction q of the generations fall
+double stepPercentile(double q)
+{
+	if (numStepTimes == 0)
+		return 0.;
+	std::sort(stepTimes, stepTimes + numStepTimes);
+	return 1000. * stepTimes[(unsigned int) (q * (numStepTimes - 1))];
+}
+
+//	observeMetric, histogramPercentile and histogramMax are those of version
+//	3's metrics.cpp: the percentile (in µs) is taken at the geometric middle
+//	of the bucket (0.5 for bucket 0, under 1 µs), the maximum is the upper
+//	bound of the highest non-empty bucket
+void observeMetric(MetricHistogram* histogram, double seconds)
+{
+	double us = 1.e6 * seconds;
+	int b = us >= 1. ? 1 + (int) (4. * log2(us)) : 0;
+	if (b >= METRIC_BUCKETS)
+		b = METRIC_BUCKETS - 1;
+	histogram->counts[b].fetch_add(1, std::memory_order_relaxed);
+	histogram->sumNs.fetch_add((unsigned long) (1.e9 * seconds), std::memory_order_relaxed);
+}
+
+double histogramPercentile(const unsigned long* counts, double q)
+{
+	unsigned long total = 0;
+	for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+		total += counts[b];
+	if (total == 0)
+		return 0.;
+	unsigned long rank = (unsigned long) (q * (total - 1)), seen = 0;
+	unsigned int b = 0;
+	for ( ; b < METRIC_BUCKETS - 1; b++) {
+		seen += counts[b];
+		if (seen > rank)
+			break;
+	}
+	return b > 0 ? pow(2., (b - 0.5) / 4.) : 0.5;
+}
+
+double histogramMax(const unsigned long* counts)
+{
+	for (int b = METRIC_BUCKETS - 1; b >= 0; b--)
+		if (counts[b] > 0)
+			return pow(2., b / 4.);
+	return 0.;
+}
+
+//	The histograms of all the threads merged, and the share of their time
+//	spent waiting rather than computing
+void reportWaits(FILE* out)
+{
+	if (threadInfo == nullptr)
+		return;
+	unsigned long counts[METRIC_BUCKETS] = {0}, total = 0;
+	double waitNs = 0., computeNs = 0.;
+	for (unsigned int k = 0; k < maxNumThreads; k++) {
+		for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+			counts[b] += threadInfo[k].waits.counts[b].load(std::memory_order_relaxed);
+		waitNs += threadInfo[k].waits.sumNs.load(std::memory_order_relaxed);
+		computeNs += threadInfo[k].computeNs.load(std::memory_order_relaxed);
+	}
+	for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+		total += counts[b];
+	fprintf(out, "barrier waits %lu wait-p50-us %.1f wait-p90-us %.1f wait-p99-us %.1f wait-max-us %.1f"
+			" wait-total-s %.3f wait-fraction %.1f%%\n",
+			total, histogramPercentile(counts, 0.50), histogramPercentile(counts, 0.90),
+			histogramPercentile(counts, 0.99), histogramMax(counts), 1.e-9 * waitNs,
+			waitNs + computeNs > 0. ? 100. * waitNs / (waitNs + computeNs) : 0.);
+}
+
+double currentTime(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1.e-9 * t.tv_nsec;
+}
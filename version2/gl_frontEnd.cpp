@@ -371,7 +371,7 @@ void myKeyboard(unsigned char c, int x, int y)
 			rule = CORAL_GROWTH_RULE;
 			break;
 
-		//	'3' --> apply Rule 3 (Amoeba: B357/S1358)
+		//	'3' --> apply Rule 3 (Amoeba: B1358/S1358)
 		case '3':
 			rule = AMOEBA_RULE;
 			break;
@@ -9,6 +9,11 @@
 #define GL_FRONT_END_H
 
 
+//------------------------------------------------------------------------------
+//	A headless build (HEADLESS defined) only uses the data types and
+//	the functions implemented in main.cpp, and doesn't need GL or glut.
+//------------------------------------------------------------------------------
+#ifndef HEADLESS
 //------------------------------------------------------------------------------
 //	Find out whether we are on Linux or macOS (sorry, Windows people)
 //	and load the OpenGL & glut headers.
@@ -29,6 +34,7 @@
 #else
 	#error unknown OS
 #endif
+#endif // HEADLESS
 
 
 //-----------------------------------------------------------------------------
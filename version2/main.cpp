@@ -38,7 +38,7 @@
  |																			|
  |		- '1' --> apply Rule 1 (Conway's classical Game of Life: B3/S23)	|
  |		- '2' --> apply Rule 2 (Coral: B3/S45678)							|
- |		- '3' --> apply Rule 3 (Amoeba: B357/S1358)							|
+ |		- '3' --> apply Rule 3 (Amoeba: B1358/S1358)						|
  |		- '4' --> apply Rule 4 (Maze: B3/S12345)							|
  |																			|
  +-------------------------------------------------------------------------*/
@@ -49,16 +49,34 @@
 #include <unistd.h>
 #include <time.h>
 #include <pthread.h>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
  //
 #include "gl_frontEnd.h"
 
 //==================================================================================
 //	Custom data types
 //==================================================================================
+//	Wait times of a thread, in the buckets of version 3's MetricHistogram:
+//	bucket 0 counts the waits under 1 microsecond, bucket b those between
+//	2^((b-1)/4) and 2^(b/4) microseconds, and the last one everything
+//	above.  Only the thread itself adds to its histogram.
+#define METRIC_BUCKETS	96
+using MetricHistogram = struct {
+	std::atomic<unsigned long> counts[METRIC_BUCKETS];
+	std::atomic<unsigned long> sumNs;
+};
+
 using ThreadInfo = struct
 {
 	pthread_t id;
 	unsigned int index;
+	//	time taken by each acquisition of the locks about a cell, and the
+	//	time spent doing anything else (with --lock-waits only)
+	MetricHistogram waits;
+	std::atomic<unsigned long> busyNs;
 };
 
 
@@ -72,6 +90,18 @@ void* threadFunc(void*);
 unsigned int cellNewState(unsigned int i, unsigned int j);
 void aquireLocksAbout(unsigned int row, unsigned int col);
 void releaseLocksAbout(unsigned int row, unsigned int col);
+unsigned int neighborRange(unsigned int center, unsigned int n, unsigned int* index);
+void lockedCells(unsigned int row, unsigned int col, unsigned int* rows, unsigned int* numLockedRows,
+				 unsigned int* cols, unsigned int* numLockedCols);
+void createThreads(void);
+double currentTime(void);
+void parseOptions(int argc, char** argv);
+void runHeadless(void);
+double stepPercentile(double q);
+void observeMetric(MetricHistogram* histogram, double seconds);
+double histogramPercentile(const unsigned long* counts, double q);
+double histogramMax(const unsigned long* counts);
+void reportWaits(FILE* out);
 
 
 //==================================================================================
@@ -82,18 +112,23 @@ void releaseLocksAbout(unsigned int row, unsigned int col);
 #define FRAME_DEAD		0	//	cell borders are kept dead
 #define FRAME_RANDOM	1	//	new random values are generated at each generation
 #define FRAME_CLIPPED	2	//	same rule as elsewhere, with clipping to stay within bounds
-#define FRAME_WRAPPED	3	//	same rule as elsewhere, with wrapping around at edges
+#define FRAME_WRAP		3	//	same rule as elsewhere, with wrapping around at edges
 
-//	Pick one value for FRAME_BEHAVIOR
+//	Pick one value for FRAME_BEHAVIOR (or define it when compiling, as the
+//	benchmark does: -DFRAME_BEHAVIOR=3)
+#ifndef FRAME_BEHAVIOR
 #define FRAME_BEHAVIOR	FRAME_DEAD
+#endif
 
 //==================================================================================
 //	Application-level global variables
 //==================================================================================
 
 //	Don't touch
+#ifndef HEADLESS
 extern int GRID_PANE, STATE_PANE;
 extern int gMainWindow, gSubwindow[2];
+#endif
 
 //	The state grid and its dimensions.  We now have two copies of the grid:
 // We have 2 separate 2D arrays, one for state, one for locks //remove
@@ -116,6 +151,29 @@ unsigned int colorMode = 0;
 
 ThreadInfo* threadInfo;
 
+//	Headless mode (for the benchmark, see ../bench.sh): no window, the
+//	workers run flat out for maxGenerations sweeps, then the throughput and
+//	the sweep times are reported.  There are no generations here: a sweep
+//	is as many cell updates as there are cells in the grid, wherever they
+//	land.  A build with HEADLESS defined does not use (nor link) GL/glut.
+#ifdef HEADLESS
+bool headless = true;
+#else
+bool headless = false;
+#endif
+unsigned int maxGenerations = 0;
+unsigned int seed = 0;
+std::atomic<unsigned long> cellUpdates(0);
+
+//	Timing every acquisition of the locks takes two clock reads per cell
+//	update, about as long as the update itself, so it is only done (and
+//	reported at exit) with --lock-waits
+bool timeLockWaits = false;
+
+//	Time at which each sweep was completed (sweepEnd[0] is the start of
+//	the run)
+double* sweepEnd = nullptr;
+
 
 //==================================================================================
 //	These are the functions that tie the simulation with the rendering.
@@ -124,6 +182,7 @@ ThreadInfo* threadInfo;
 //==================================================================================
 
 
+#ifndef HEADLESS
 void displayGridPane(void)
 {
 	//	This is OpenGL/glut magic.  Don't touch
@@ -163,18 +222,32 @@ void displayStatePane(void)
 	glutSwapBuffers();
 	glutSetWindow(gMainWindow);
 }
+#endif
 
 
 int main(int argc, char** argv) {
-	if (argc != 4) {
+	if (argc < 4) {
 		fprintf(stderr, "cell v2 program launched with incorrect number of arguments.\n"
-			"Proper usage: ./cell [number of rows] [number of cols] [max number of live threads]\n");
+			"Proper usage: ./cell [number of rows] [number of cols] [max number of live threads] [options]\n"
+			"Options:\n"
+			"    --headless               no window: run, then report the throughput\n"
+			"    --generations G          stop after G sweeps (rows x cols cell updates each)\n"
+			"    --rule R                 start with rule R (1 to 4)\n"
+			"    --seed S                 seed of the random generator\n"
+			"    --lock-waits             time the lock acquisitions, report them at exit\n");
 		exit(1);
 	}
 	numRows = (unsigned int)strtoul(argv[1], NULL, 10);
 	numCols = (unsigned int)strtoul(argv[2], NULL, 10);
 	maxNumThreads = (unsigned int)strtoul(argv[3], NULL, 10);
+	parseOptions(argc, argv);
+
+	if (headless) {
+		initializeApplication();
+		runHeadless();
+	}
 
+#ifndef HEADLESS
 	//	This takes care of initializing glut and the GUI.
 	//	You shouldn’t have to touch this
 	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
@@ -183,25 +256,14 @@ int main(int argc, char** argv) {
 	initializeApplication();
 
 	//	Now would be the place & time to create mutex locks and threads
-	threadInfo = new ThreadInfo[maxNumThreads];
-	for (unsigned int k = 0; k < maxNumThreads; k++) {
-		threadInfo[k].index = k;
-	}
-	for (unsigned int k = 0; k < maxNumThreads; k++) {
-		int error_code = pthread_create(&(threadInfo[k].id),
-			nullptr,
-			threadFunc,
-			threadInfo + k);
-		if (error_code < 0)
-			std::cerr << "ERROR: Failed to create ghost thread with error code " << error_code << std::endl;
-		else numLiveThreads++;  // increment counter to display on GUI
-	}
+	createThreads();
 
 	//	Now we enter the main loop of the program and to a large extend
 	//	"lose control" over its execution.  The callback functions that 
 	//	we set up earlier will be called when the corresponding event
 	//	occurs
 	glutMainLoop();
+#endif
 
 	//	This will never be executed (the exit point will be in one of the
 	//	call back functions).
@@ -220,6 +282,7 @@ void cleanupAndQuit(void)
 	}
 	delete[]grid;
 
+	reportWaits(stdout);
 	exit(0);
 }
 
@@ -248,7 +311,7 @@ void initializeApplication(void)
 	//	simulation), only some color, in meant-to-be-thrown-away code
 
 	//	seed the pseudo-random generator
-	srand((unsigned int)time(NULL));
+	srand(seed != 0 ? seed : (unsigned int)time(NULL));
 
 	resetGrid();
 }
@@ -256,9 +319,10 @@ void initializeApplication(void)
 
 void* threadFunc(void* arg)
 {
-	(void)arg;
+	ThreadInfo* info = static_cast<ThreadInfo*>(arg);
 
 	bool keepGoing = true;
+	double lockedTime = currentTime();
 	while (keepGoing) {
 		// pick a random grid cell
 		unsigned int row, col;
@@ -267,7 +331,16 @@ void* threadFunc(void* arg)
 		col = rand() % numCols;
 
 		//aquire lock(s) about (row, col) cell
-		aquireLocksAbout(row, col);
+		if (timeLockWaits) {
+			double lockStart = currentTime();
+			aquireLocksAbout(row, col);
+			double now = currentTime();
+			observeMetric(&info->waits, now - lockStart);
+			info->busyNs.fetch_add((unsigned long) (1e9 * (lockStart - lockedTime)), std::memory_order_relaxed);
+			lockedTime = now;
+		}
+		else
+			aquireLocksAbout(row, col);
 		unsigned int newState = cellNewState(row, col);
 
 		//	In black and white mode, only alive/dead matters
@@ -288,7 +361,17 @@ void* threadFunc(void* arg)
 		// Release lock(s) about (row, col) cell
 		releaseLocksAbout(row, col);
 
-		usleep(speed);
+		//	count the updates of a run with a fixed length
+		if (maxGenerations > 0) {
+			const unsigned long cellsPerSweep = (unsigned long) numRows * numCols;
+			unsigned long n = cellUpdates.fetch_add(1, std::memory_order_relaxed) + 1;
+			if (n % cellsPerSweep == 0 && n / cellsPerSweep <= maxGenerations)
+				sweepEnd[n / cellsPerSweep] = currentTime();
+			keepGoing = n < maxGenerations * cellsPerSweep;
+		}
+
+		if (speed > 0)
+			usleep(speed);
 	}
 	return NULL;
 }
@@ -371,20 +454,20 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 		}
 
 
-#elif FRAME_BEHAVIOR == FRAME_WRAPPED
+#elif FRAME_BEHAVIOR == FRAME_WRAP
 
 		unsigned int 	iM1 = (i + numRows - 1) % numRows,
 			iP1 = (i + 1) % numRows,
 			jM1 = (j + numCols - 1) % numCols,
 			jP1 = (j + 1) % numCols;
-		count = grid[iM1][jM1] != 0 +
-			grid[iM1][j] != 0 +
-			grid[iM1][jP1] != 0 +
-			grid[i][jM1] != 0 +
-			grid[i][jP1] != 0 +
-			grid[iP1][jM1] != 0 +
-			grid[iP1][j] != 0 +
-			grid[iP1][jP1] != 0;
+		count = (grid[iM1][jM1] != 0) +
+			(grid[iM1][j] != 0) +
+			(grid[iM1][jP1] != 0) +
+			(grid[i][jM1] != 0) +
+			(grid[i][jP1] != 0) +
+			(grid[iP1][jM1] != 0) +
+			(grid[iP1][j] != 0) +
+			(grid[iP1][jP1] != 0);
 
 #else
 #error undefined frame behavior
@@ -435,7 +518,7 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 		}
 		break;
 
-		//	Rule 3 (Amoeba: B357/S1358)
+		//	Rule 3 (Amoeba: B1358/S1358)
 	case AMOEBA_RULE:
 
 		//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
@@ -479,62 +562,213 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 	return newState;
 }
 
+//	Rows (or columns) of the cells around index center, in increasing
+//	order, wrapped or clipped at the edges.  Returns how many there are (on
+//	a grid narrower than 3, wrapping gives the same index twice).
+unsigned int neighborRange(unsigned int center, unsigned int n, unsigned int* index) {
+	unsigned int count = 0;
+	for (int d = -1; d <= +1; d++) {
+#if FRAME_BEHAVIOR == FRAME_WRAP
+		index[count++] = (center + n + d) % n;
+#else
+		if ((int) center + d >= 0 && center + d < n)
+			index[count++] = center + d;
+#endif
+	}
+	std::sort(index, index + count);
+	return (unsigned int) (std::unique(index, index + count) - index);
+}
+
+//	Cells whose locks are held while the cell at (row, col) is updated: the
+//	cell and the neighbors that its new state depends on.  Since rows and
+//	cols come in increasing order, every thread takes its locks in the same
+//	(row-major) order, so that none can deadlock.
+void lockedCells(unsigned int row, unsigned int col, unsigned int* rows, unsigned int* numLockedRows,
+				 unsigned int* cols, unsigned int* numLockedCols) {
+#if FRAME_BEHAVIOR == FRAME_DEAD || FRAME_BEHAVIOR == FRAME_RANDOM
+	//	On the border, neighbors are ignored (the cell stays dead, or gets a
+	//	random count)
+	if (row == 0 || row == numRows - 1 || col == 0 || col == numCols - 1) {
+		rows[0] = row;
+		cols[0] = col;
+		*numLockedRows = *numLockedCols = 1;
+		return;
+	}
+#endif
+	*numLockedRows = neighborRange(row, numRows, rows);
+	*numLockedCols = neighborRange(col, numCols, cols);
+}
+
 void aquireLocksAbout(unsigned int row, unsigned int col) {
-#if FRAME_BEHAVIOR == FRAME_DEAD
-	// If the cell is not on the border, we lock all 9 cells
-	if (row > 0 && row < numRows - 1 && col>0 && col < numCols - 1)
-		for (int i = -1; i < +1; i++)
-			for (int j = -1; j < +1; j++)
-				pthread_mutex_lock(&(cellLock[row + i][col + j]));
-	// Else, on border neighbors are ignored (cell stays dead)
-	else
-		pthread_mutex_lock(&(cellLock[row][col]));
+	unsigned int rows[3], cols[3], numLockedRows, numLockedCols;
+	lockedCells(row, col, rows, &numLockedRows, cols, &numLockedCols);
+	for (unsigned int i = 0; i < numLockedRows; i++)
+		for (unsigned int j = 0; j < numLockedCols; j++)
+			pthread_mutex_lock(&(cellLock[rows[i]][cols[j]]));
+}
 
-#elif FRAME_BEHAVIOR == FRAME_RANDOM
-	pthread_mutex_lock(cellLock[row] + col);
+void releaseLocksAbout(unsigned int row, unsigned int col) {
+	unsigned int rows[3], cols[3], numLockedRows, numLockedCols;
+	lockedCells(row, col, rows, &numLockedRows, cols, &numLockedCols);
+	for (unsigned int i = 0; i < numLockedRows; i++)
+		for (unsigned int j = 0; j < numLockedCols; j++)
+			pthread_mutex_unlock(&(cellLock[rows[i]][cols[j]]));
+}
 
-#elif FRAME_BEHAVIOR == FRAME_CLIPPED
-	// increasing order for rows and columns
-	for (int i = -1; i < +1; i++)
-		for (int j = -1; j < +1; j++)
-			// if row+i and col+j are within the grid
-			if (row + k >= 0 && row + i < numRows && col + j >= 0 && col + j < numCols)
-				pthread_mutex_lock(&(cellLock[row + i][col + j]));
+void createThreads(void) {
+	threadInfo = new ThreadInfo[maxNumThreads];
+	for (unsigned int k = 0; k < maxNumThreads; k++) {
+		threadInfo[k].index = k;
+		for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+			threadInfo[k].waits.counts[b] = 0;
+		threadInfo[k].waits.sumNs = 0;
+		threadInfo[k].busyNs = 0;
+	}
+	for (unsigned int k = 0; k < maxNumThreads; k++) {
+		int error_code = pthread_create(&(threadInfo[k].id),
+			nullptr,
+			threadFunc,
+			threadInfo + k);
+		if (error_code < 0)
+			std::cerr << "ERROR: Failed to create ghost thread with error code " << error_code << std::endl;
+		else numLiveThreads++;  // increment counter to display on GUI
+	}
+}
 
+//	Options that follow the three numbers of the command line
+void parseOptions(int argc, char** argv) {
+	for (int k = 4; k < argc; k++) {
+		if (!strcmp(argv[k], "--headless"))
+			headless = true;
+		else if (!strcmp(argv[k], "--generations") && k + 1 < argc)
+			maxGenerations = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--rule") && k + 1 < argc) {
+			rule = (unsigned int)strtoul(argv[++k], NULL, 10);
+			if (rule < GAME_OF_LIFE_RULE || rule > MAZE_RULE) {
+				fprintf(stderr, "Invalid rule number\n");
+				exit(1);
+			}
+		}
+		else if (!strcmp(argv[k], "--seed") && k + 1 < argc)
+			seed = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--lock-waits"))
+			timeLockWaits = true;
+		else {
+			fprintf(stderr, "Unknown or incomplete option %s\n", argv[k]);
+			exit(1);
+		}
+	}
+	if (headless && maxGenerations == 0) {
+		fprintf(stderr, "a headless run needs --generations\n");
+		exit(1);
+	}
+}
 
-#elif FRAME_BEHAVIOR == FRAME_WRAP
-	for (int i = -1; i < +1; i++)
-		for (int j = -1; j < +1; j++)
-			pthread_mutex_lock(&(cellLock[(row + numRows + i) % numRows][(col + numCols + j) % numCols]));
+//	Same report as version 3's headless runs (with sweeps for generations),
+//	so that bench.sh can compare the engines
+void runHeadless(void) {
+	//	no point in slowing down the simulation
+	speed = 0;
+	sweepEnd = new double[maxGenerations + 1];
+
+	sweepEnd[0] = currentTime();
+	createThreads();
+	//	the workers quit once the last sweep is done
+	for (unsigned int k = 0; k < maxNumThreads; k++)
+		pthread_join(threadInfo[k].id, nullptr);
+	double elapsed = currentTime() - sweepEnd[0];
+
+	unsigned long population = 0;
+	for (unsigned int i = 0; i < numRows; i++)
+		for (unsigned int j = 0; j < numCols; j++)
+			population += grid[i][j] != 0;
+	double updates = (double) maxGenerations * numRows * numCols;
+	printf("rows 0-%u generation %u population %lu elapsed %.3f s %.1f generations/s %.0f cell updates/s"
+		   " p50-ms %.3f p99-ms %.3f\n",
+		   numRows - 1, maxGenerations, population, elapsed,
+		   elapsed > 0. ? maxGenerations / elapsed : 0., elapsed > 0. ? updates / elapsed : 0.,
+		   stepPercentile(0.50), stepPercentile(0.99));
+	cleanupAndQuit();
+}
 
-#endif
+//	Sweep time (in ms) below which a fraction q of the sweeps fall
+double stepPercentile(double q)
+{
+	//	sweepEnd[k] becomes the duration of sweep k
+	static bool sorted = false;
+	if (!sorted) {
+		for (unsigned int k = maxGenerations; k > 0; k--)
+			sweepEnd[k] -= sweepEnd[k - 1];
+		std::sort(sweepEnd + 1, sweepEnd + maxGenerations + 1);
+		sorted = true;
+	}
+	return 1000. * sweepEnd[1 + (unsigned int) (q * (maxGenerations - 1))];
 }
-void releaseLocksAbout(unsigned int row, unsigned int col) {
-#if FRAME_BEHAVIOR == FRAME_DEAD
-	// If the cell is not on the border, we lock all nine cells
-	if (row > 0 && row < numRows - 1 && col>0 && col < numCols - 1)
-		for (int i = -1; i < 1; i++)
-			for (int j = -1; j < 1; j++)
-				pthread_mutex_unlock(&(cellLock[row + i][col + j]));
-	// else, on border, neighbors are ignored (cell stays dead)
-	else
-		pthread_mutex_unlock(&(cellLock[row][col]));
 
-#elif FRAME_BEHAVIOR == FRAME_RANDOM
-	pthread_mutex_unlock(cellLock[row] + col);
+//	observeMetric, histogramPercentile and histogramMax are those of version
+//	3's metrics.cpp: the percentile (in µs) is taken at the geometric middle
+//	of the bucket (0.5 for bucket 0, under 1 µs), the maximum is the upper
+//	bound of the highest non-empty bucket
+void observeMetric(MetricHistogram* histogram, double seconds)
+{
+	double us = 1.e6 * seconds;
+	int b = us >= 1. ? 1 + (int) (4. * log2(us)) : 0;
+	if (b >= METRIC_BUCKETS)
+		b = METRIC_BUCKETS - 1;
+	histogram->counts[b].fetch_add(1, std::memory_order_relaxed);
+	histogram->sumNs.fetch_add((unsigned long) (1.e9 * seconds), std::memory_order_relaxed);
+}
 
-#elif FRAME_BEHAVIOR == FRAME_CLIPPED
-	// increasing order for rows and columns
-	for (int i = -1; i < +1; i++)
-		for (int j = -1; j < +1; j++)
-			// if row+i and col+j are within the grid
-			if (row + k >= 0 && row + i < numRows && col + j >= 0 && col + j < numCols)
-				pthread_mutex_lock(&(cellLock[row + i][col + j]));
-
-#elif FRAME_BEHAVIOR == FRAME_WRAPPED
-	for (int i = -1; i < +1; i++)
-		for (int j = -1; j < +1; j++)
-			pthread_mutex_unlock(&(cellLock[(row + numRows + i) % numRows][(col + numCols + j) % numCols]));
+double histogramPercentile(const unsigned long* counts, double q)
+{
+	unsigned long total = 0;
+	for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+		total += counts[b];
+	if (total == 0)
+		return 0.;
+	unsigned long rank = (unsigned long) (q * (total - 1)), seen = 0;
+	unsigned int b = 0;
+	for ( ; b < METRIC_BUCKETS - 1; b++) {
+		seen += counts[b];
+		if (seen > rank)
+			break;
+	}
+	return b > 0 ? pow(2., (b - 0.5) / 4.) : 0.5;
+}
 
-#endif
-}
\ No newline at end of file
+double histogramMax(const unsigned long* counts)
+{
+	for (int b = METRIC_BUCKETS - 1; b >= 0; b--)
+		if (counts[b] > 0)
+			return pow(2., b / 4.);
+	return 0.;
+}
+
+//	The histograms of all the threads merged, and the share of their time
+//	spent waiting for locks (nothing without --lock-waits)
+void reportWaits(FILE* out)
+{
+	if (threadInfo == nullptr || !timeLockWaits)
+		return;
+	unsigned long counts[METRIC_BUCKETS] = {0}, total = 0;
+	double waitNs = 0., busyNs = 0.;
+	for (unsigned int k = 0; k < maxNumThreads; k++) {
+		for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+			counts[b] += threadInfo[k].waits.counts[b].load(std::memory_order_relaxed);
+		waitNs += threadInfo[k].waits.sumNs.load(std::memory_order_relaxed);
+		busyNs += threadInfo[k].busyNs.load(std::memory_order_relaxed);
+	}
+	for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+		total += counts[b];
+	fprintf(out, "lock waits %lu wait-p50-us %.1f wait-p90-us %.1f wait-p99-us %.1f wait-max-us %.1f"
+			" wait-total-s %.3f wait-fraction %.1f%%\n",
+			total, histogramPercentile(counts, 0.50), histogramPercentile(counts, 0.90),
+			histogramPercentile(counts, 0.99), histogramMax(counts), 1.e-9 * waitNs,
+			waitNs + busyNs > 0. ? 100. * waitNs / (waitNs + busyNs) : 0.);
+}
+
+double currentTime(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1.e-9 * t.tv_nsec;
+}
@@ -21,8 +21,9 @@ mkfifo /tmp/pipe
 PIPE=/tmp/pipe
 
 # compile program
-g++ main.cpp gl_frontEnd.cpp -lm -lGL -lglut -lpthread -o cell
-if [ -f cell ]
+source "$(dirname "$0")/sources.sh"
+g++ $SOURCES $SOURCE_DIR/gl_frontEnd.cpp -lm -lGL -lglut -lpthread -lrt -o $SOURCE_DIR/cell
+if [ -f $SOURCE_DIR/cell ]
 then	
 	echo "built cell"
 	#./cell $1 $2 $3
@@ -0,0 +1,341 @@
+//
+//  checkpoint.cpp
+//  Cellular Automaton
+//
+//	Saving and loading are split by rows between a few short-lived threads.
+//	To save, each thread packs blocks of rows in a buffer of its own and
+//	writes them in place with pwrite (the rows all have the same packed size,
+//	so their offsets are known).  To load, the file is mapped and each
+//	thread unpacks its rows straight from the mapping.
+//
+//	The temporary file is synced before the rename, and the directory after
+//	it, so that the checkpoint is complete once saveCheckpoint returns.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+//
+#include "gl_frontEnd.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_VERSION		1
+#define CHECKPOINT_HEADER_SIZE	64
+#define SAVE_BLOCK_SIZE			(1 << 20)	//	bytes packed before each pwrite
+
+//	Work shared by the threads of a save or a load
+using CheckpointJob = struct {
+	unsigned int** grid;
+	unsigned int numRows, numCols;
+	unsigned int bitsPerCell;
+	size_t rowBytes;
+	unsigned int numThreads;
+	int fd;						//	save
+	const unsigned char* data;	//	load: the packed rows
+	std::atomic<bool> failed;
+};
+
+using CheckpointWorker = struct {
+	CheckpointJob* job;
+	unsigned int index;
+};
+
+static bool syncDirectory(const char* path);
+static bool runJob(CheckpointJob* job, void* (*func)(void*));
+static void* saveRows(void* arg);
+static void* loadRows(void* arg);
+static void packRow(unsigned char* out, const unsigned int* row, unsigned int numCols, unsigned int bitsPerCell);
+static bool unpackRow(unsigned int* row, const unsigned char* in, unsigned int numCols, unsigned int bitsPerCell);
+static void putInt(unsigned char* dst, unsigned long value, int numBytes);
+static unsigned long getInt(const unsigned char* src, int numBytes);
+
+
+bool saveCheckpoint(const char* path, unsigned int** grid, CheckpointInfo* info,
+					unsigned int numThreads)
+{
+	info->bitsPerCell = info->colorMode ? 4 : 1;
+	CheckpointJob job;
+	job.grid = grid;
+	job.numRows = info->numRows;
+	job.numCols = info->numCols;
+	job.bitsPerCell = info->bitsPerCell;
+	job.rowBytes = ((size_t) info->numCols * info->bitsPerCell + 7) / 8;
+	job.numThreads = numThreads > 0 ? numThreads : 1;
+	job.data = nullptr;
+	job.failed = false;
+
+	char tempPath[4096];
+	snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+	job.fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (job.fd < 0)
+	{
+		std::cerr << "ERROR: cannot create " << tempPath << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	unsigned char header[CHECKPOINT_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, "CACK", 4);
+	putInt(header + 4, CHECKPOINT_VERSION, 4);
+	putInt(header + 8, info->numRows, 4);
+	putInt(header + 12, info->numCols, 4);
+	putInt(header + 16, info->rule, 4);
+	putInt(header + 20, info->frameBehavior, 4);
+	putInt(header + 24, info->colorMode, 4);
+	putInt(header + 28, info->bitsPerCell, 4);
+	putInt(header + 32, (unsigned long) info->generation, 8);
+	putInt(header + 40, info->rngState, 8);
+
+	bool ok = pwrite(job.fd, header, sizeof(header), 0) == (ssize_t) sizeof(header) &&
+			  runJob(&job, saveRows) && fsync(job.fd) == 0;
+	ok = close(job.fd) == 0 && ok;
+	if (ok && (rename(tempPath, path) < 0 || !syncDirectory(path)))
+		ok = false;
+	if (!ok)
+	{
+		std::cerr << "ERROR: cannot write checkpoint " << path << ": " << strerror(errno) << std::endl;
+		unlink(tempPath);
+	}
+	return ok;
+}
+
+
+bool readCheckpointInfo(const char* path, CheckpointInfo* info)
+{
+	unsigned char header[CHECKPOINT_HEADER_SIZE];
+	int fd = open(path, O_RDONLY);
+	bool ok = fd >= 0 && read(fd, header, sizeof(header)) == (ssize_t) sizeof(header);
+	if (fd >= 0)
+		close(fd);
+	if (!ok || memcmp(header, "CACK", 4) != 0 || getInt(header + 4, 4) != CHECKPOINT_VERSION)
+	{
+		std::cerr << "ERROR: " << path << " is not a readable checkpoint" << std::endl;
+		return false;
+	}
+	info->numRows = (unsigned int) getInt(header + 8, 4);
+	info->numCols = (unsigned int) getInt(header + 12, 4);
+	info->rule = (unsigned int) getInt(header + 16, 4);
+	info->frameBehavior = (unsigned int) getInt(header + 20, 4);
+	info->colorMode = (unsigned int) getInt(header + 24, 4);
+	info->bitsPerCell = (unsigned int) getInt(header + 28, 4);
+	info->generation = (long) getInt(header + 32, 8);
+	info->rngState = getInt(header + 40, 8);
+	if (info->bitsPerCell != 1 && info->bitsPerCell != 4)
+	{
+		std::cerr << "ERROR: " << path << " is not a readable checkpoint" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+bool loadCheckpoint(const char* path, unsigned int** grid, unsigned int numRows,
+					unsigned int numCols, CheckpointInfo* info, unsigned int numThreads)
+{
+	if (!readCheckpointInfo(path, info))
+		return false;
+	if (info->numRows != numRows || info->numCols != numCols)
+	{
+		std::cerr << "ERROR: checkpoint " << path << " is " << info->numRows << " x " << info->numCols
+				  << ", not " << numRows << " x " << numCols << std::endl;
+		return false;
+	}
+
+	CheckpointJob job;
+	job.grid = grid;
+	job.numRows = numRows;
+	job.numCols = numCols;
+	job.bitsPerCell = info->bitsPerCell;
+	job.rowBytes = ((size_t) numCols * info->bitsPerCell + 7) / 8;
+	job.numThreads = numThreads > 0 ? numThreads : 1;
+	job.fd = -1;
+	job.failed = false;
+
+	size_t size = CHECKPOINT_HEADER_SIZE + job.rowBytes * numRows;
+	int fd = open(path, O_RDONLY);
+	struct stat fileInfo;
+	if (fd < 0 || fstat(fd, &fileInfo) < 0 || (size_t) fileInfo.st_size < size)
+	{
+		std::cerr << "ERROR: checkpoint " << path << " is truncated" << std::endl;
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	void* mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+	{
+		std::cerr << "ERROR: cannot map " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	//	every thread reads its part front to back
+	madvise(mem, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	job.data = static_cast<const unsigned char*>(mem) + CHECKPOINT_HEADER_SIZE;
+
+	bool ok = runJob(&job, loadRows);
+	munmap(mem, size);
+	if (!ok)
+		std::cerr << "ERROR: checkpoint " << path << " has cell ages above " << NB_COLORS - 1 << std::endl;
+	return ok;
+}
+
+
+//	Syncs the directory that holds path, so that a rename in it is durable
+static bool syncDirectory(const char* path)
+{
+	char dirPath[4096];
+	snprintf(dirPath, sizeof(dirPath), "%s", path);
+	char* slash = strrchr(dirPath, '/');
+	if (slash == nullptr)
+		strcpy(dirPath, ".");
+	else
+		slash[slash == dirPath ? 1 : 0] = '\0';
+	int fd = open(dirPath, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return false;
+	bool ok = fsync(fd) == 0;
+	close(fd);
+	return ok;
+}
+
+
+//	Runs func on job->numThreads threads (the calling one included)
+static bool runJob(CheckpointJob* job, void* (*func)(void*))
+{
+	if (job->numThreads > job->numRows)
+		job->numThreads = job->numRows > 0 ? job->numRows : 1;
+	CheckpointWorker* workers = new CheckpointWorker[job->numThreads];
+	pthread_t* ids = new pthread_t[job->numThreads];
+	unsigned int numStarted = 1;
+	for (unsigned int k=0; k<job->numThreads; k++)
+	{
+		workers[k].job = job;
+		workers[k].index = k;
+	}
+	for (unsigned int k=1; k<job->numThreads; k++, numStarted++)
+		if (pthread_create(ids + k, nullptr, func, workers + k) != 0)
+			break;
+	//	this thread also takes the share of the threads that could not be created
+	func(workers);
+	for (unsigned int k=numStarted; k<job->numThreads; k++)
+		func(workers + k);
+	for (unsigned int k=1; k<numStarted; k++)
+		pthread_join(ids[k], nullptr);
+
+	delete []workers;
+	delete []ids;
+	return !job->failed;
+}
+
+//	Thread k handles the rows k*numRows/numThreads to (k+1)*numRows/numThreads - 1
+static void* saveRows(void* arg)
+{
+	CheckpointWorker* worker = static_cast<CheckpointWorker*>(arg);
+	CheckpointJob* job = worker->job;
+	unsigned int firstRow = (unsigned int) (((unsigned long) worker->index * job->numRows) / job->numThreads);
+	unsigned int endRow = (unsigned int) (((unsigned long) (worker->index + 1) * job->numRows) / job->numThreads);
+
+	unsigned int rowsPerBlock = job->rowBytes >= SAVE_BLOCK_SIZE ? 1 : (unsigned int) (SAVE_BLOCK_SIZE / job->rowBytes);
+	unsigned char* block = (unsigned char*) malloc(rowsPerBlock * job->rowBytes);
+	for (unsigned int i=firstRow; i<endRow && !job->failed; i+=rowsPerBlock)
+	{
+		unsigned int numBlockRows = endRow - i < rowsPerBlock ? endRow - i : rowsPerBlock;
+		for (unsigned int r=0; r<numBlockRows; r++)
+			packRow(block + r * job->rowBytes, job->grid[i + r], job->numCols, job->bitsPerCell);
+
+		size_t size = numBlockRows * job->rowBytes, done = 0;
+		off_t offset = CHECKPOINT_HEADER_SIZE + (off_t) i * job->rowBytes;
+		while (done < size)
+		{
+			ssize_t n = pwrite(job->fd, block + done, size - done, offset + done);
+			if (n <= 0)
+			{
+				job->failed = true;
+				break;
+			}
+			done += n;
+		}
+	}
+	free(block);
+	return nullptr;
+}
+
+static void* loadRows(void* arg)
+{
+	CheckpointWorker* worker = static_cast<CheckpointWorker*>(arg);
+	CheckpointJob* job = worker->job;
+	unsigned int firstRow = (unsigned int) (((unsigned long) worker->index * job->numRows) / job->numThreads);
+	unsigned int endRow = (unsigned int) (((unsigned long) (worker->index + 1) * job->numRows) / job->numThreads);
+
+	for (unsigned int i=firstRow; i<endRow && !job->failed; i++)
+		if (!unpackRow(job->grid[i], job->data + (size_t) i * job->rowBytes, job->numCols, job->bitsPerCell))
+			job->failed = true;
+	return nullptr;
+}
+
+static void packRow(unsigned char* out, const unsigned int* row, unsigned int numCols, unsigned int bitsPerCell)
+{
+	unsigned int j = 0;
+	if (bitsPerCell == 1)
+	{
+		for ( ; j + 8 <= numCols; j += 8)
+			*out++ = (unsigned char) (((row[j] != 0) << 7) | ((row[j+1] != 0) << 6) |
+									  ((row[j+2] != 0) << 5) | ((row[j+3] != 0) << 4) |
+									  ((row[j+4] != 0) << 3) | ((row[j+5] != 0) << 2) |
+									  ((row[j+6] != 0) << 1) | (row[j+7] != 0));
+		if (j < numCols)
+		{
+			unsigned char bits = 0;
+			for (unsigned int k=0; j+k<numCols; k++)
+				bits |= (row[j+k] != 0) << (7 - k);
+			*out = bits;
+		}
+	}
+	else
+	{
+		for ( ; j + 2 <= numCols; j += 2)
+			*out++ = (unsigned char) (((row[j] & 0xF) << 4) | (row[j+1] & 0xF));
+		if (j < numCols)
+			*out = (unsigned char) ((row[j] & 0xF) << 4);
+	}
+}
+
+//	Returns false if an age doesn't fit our colors
+static bool unpackRow(unsigned int* row, const unsigned char* in, unsigned int numCols, unsigned int bitsPerCell)
+{
+	if (bitsPerCell == 1)
+	{
+		for (unsigned int j=0; j<numCols; j++)
+			row[j] = (in[j >> 3] >> (7 - (j & 7))) & 1;
+		return true;
+	}
+	unsigned int maxAge = 0;
+	for (unsigned int j=0; j<numCols; j++)
+	{
+		row[j] = (in[j >> 1] >> ((j & 1) ? 0 : 4)) & 0xF;
+		maxAge = row[j] > maxAge ? row[j] : maxAge;
+	}
+	return maxAge < NB_COLORS;
+}
+
+static void putInt(unsigned char* dst, unsigned long value, int numBytes)
+{
+	for (int k=0; k<numBytes; k++)
+		dst[k] = (unsigned char) (value >> (8*k));
+}
+
+static unsigned long getInt(const unsigned char* src, int numBytes)
+{
+	unsigned long value = 0;
+	for (int k=0; k<numBytes; k++)
+		value |= (unsigned long) src[k] << (8*k);
+	return value;
+}
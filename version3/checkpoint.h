@@ -0,0 +1,46 @@
+//
+//  checkpoint.h
+//  Cellular Automaton
+//
+//	Checkpoints of the whole simulation state.  The file is a 64-byte header
+//	followed by the grid, row 0 first, each row packed and padded to a whole
+//	byte: one bit per cell (alive) in black and white mode, four bits per
+//	cell (its age) in color mode, most significant bits first.
+//
+//	Header (all integers little endian): "CACK", format version, numRows,
+//	numCols, rule, frame behavior, color mode, bits per cell (32 bits each),
+//	then generation and state of the random generator (64 bits each), and
+//	16 reserved bytes.
+//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+typedef struct CheckpointInfo {
+	unsigned int numRows, numCols;
+	unsigned int rule;
+	unsigned int frameBehavior;
+	unsigned int colorMode;
+	unsigned int bitsPerCell;	//	set by saveCheckpoint from colorMode
+	long generation;
+	unsigned long rngState;
+} CheckpointInfo;
+
+//	Writes the grid with numThreads threads encoding rows in parallel.  The
+//	file is written and synced under a temporary name, then renamed, so that
+//	a crash never leaves a truncated checkpoint behind.  Returns false on
+//	failure.
+bool saveCheckpoint(const char* path, unsigned int** grid, CheckpointInfo* info,
+					unsigned int numThreads);
+
+//	Only reads and checks the header.  Returns false on failure.
+bool readCheckpointInfo(const char* path, CheckpointInfo* info);
+
+//	Maps the file and decodes it into grid with numThreads threads.  Fails
+//	(and leaves the grid alone) if the dimensions aren't numRows x numCols,
+//	and fails with the grid partly decoded if a cell age is above
+//	NB_COLORS-1.
+bool loadCheckpoint(const char* path, unsigned int** grid, unsigned int numRows,
+					unsigned int numCols, CheckpointInfo* info, unsigned int numThreads);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,64 @@
+//
+//  commands.cpp
+//  Cellular Automaton
+//
+//	Lock-free multiple producers, single consumer queue: a linked list
+//	whose first node is always a dummy.  A producer swaps its node in as
+//	the new head, then links the previous head to it.  The consumer reads
+//	the node following the dummy, which then becomes the new dummy.  A
+//	producer preempted between the swap and the link only delays the
+//	commands behind its own until it resumes.
+//
+
+#include <atomic>
+#include <cstring>
+//
+#include "commands.h"
+
+using CommandNode = struct CommandNode {
+	Command command;
+	std::atomic<CommandNode*> next;
+};
+
+static CommandNode stubNode = {{0, 0, nullptr, 0}, {nullptr}};
+//	last node posted (producers), and current dummy node (consumer)
+static std::atomic<CommandNode*> queueHead(&stubNode);
+static CommandNode* queueTail = &stubNode;
+static std::atomic<unsigned long> commandsPosted(0), commandsTaken(0);
+
+
+void postCommand(int type, int value, const char* argument)
+{
+	CommandNode* node = new CommandNode;
+	node->command.type = type;
+	node->command.value = value;
+	node->command.argument = argument != nullptr ? strdup(argument) : nullptr;
+	node->command.generation = -1;
+	node->next.store(nullptr, std::memory_order_relaxed);
+
+	CommandNode* previous = queueHead.exchange(node, std::memory_order_acq_rel);
+	previous->next.store(node, std::memory_order_release);
+	commandsPosted.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+bool takeCommand(Command* command)
+{
+	CommandNode* next = queueTail->next.load(std::memory_order_acquire);
+	if (next == nullptr)
+		return false;
+	*command = next->command;
+	if (queueTail != &stubNode)
+		delete queueTail;
+	queueTail = next;
+	commandsTaken.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+
+unsigned long pendingCommands(void)
+{
+	unsigned long taken = commandsTaken.load(std::memory_order_relaxed);
+	unsigned long posted = commandsPosted.load(std::memory_order_relaxed);
+	return posted > taken ? posted - taken : 0;
+}
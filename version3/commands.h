@@ -0,0 +1,47 @@
+//
+//  commands.h
+//  Cellular Automaton
+//
+//	Queue of the control changes requested by the keyboard and the control
+//	channel.  Any thread can post a command; only the last worker to finish
+//	a generation takes them, so that a change always applies to whole
+//	generations and never races with the computation.
+//
+
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#define COMMAND_RULE		0	//	value: the new rule
+#define COMMAND_COLOR		1	//	value: 0 (off), 1 (on) or -1 (toggle)
+#define COMMAND_FASTER		2	//	value not used
+#define COMMAND_SLOWER		3	//	value not used
+#define COMMAND_RESET		4	//	value not used
+#define COMMAND_THREADS		5	//	value: the new number of worker threads
+#define COMMAND_ADD_THREADS	6	//	value: number of worker threads to add (or remove)
+#define COMMAND_SAVE		7	//	argument: path of the checkpoint to write
+#define COMMAND_LOAD		8	//	argument: path of the checkpoint to restore
+#define COMMAND_PATTERN		9	//	argument: pattern file, optionally followed by @row,col
+#define COMMAND_CLEAR		10	//	value not used
+#define COMMAND_REWIND		11	//	value: number of generations to go back
+#define COMMAND_SEEK		12	//	value: generation to go back to
+
+typedef struct Command {
+	int type;
+	int value;
+	//	copy of the argument given to postCommand (or nullptr), to be freed
+	//	by the consumer
+	char* argument;
+	//	first generation computed with the change, set when it is applied
+	int generation;
+} Command;
+
+//	Can be called by any thread, never blocks
+void postCommand(int type, int value, const char* argument = nullptr);
+
+//	Called by the consumer only.  Returns false if the queue is empty.
+bool takeCommand(Command* command);
+
+//	Commands posted but not taken yet (approximate while producers post)
+unsigned long pendingCommands(void);
+
+#endif // COMMANDS_H
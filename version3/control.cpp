@@ -0,0 +1,392 @@
+//
+//  control.cpp
+//  Cellular Automaton
+//
+//	The FIFO is opened O_RDWR: since we count as a writer ourselves, the
+//	FIFO never reports end of file when the last external writer closes
+//	it, so there is no need to reopen it (and block until the next writer
+//	shows up) after each command.  It is also non-blocking, and read until
+//	empty each time epoll reports it readable, up to CONTROL_READ_BUDGET
+//	bytes per wakeup so that a flood of commands cannot starve the rest of
+//	the loop (epoll is level triggered, the remainder is read next time
+//	around).
+//
+//	Socket clients are non-blocking too.  Replies are queued in the
+//	client's output buffer and written as the socket accepts them; while a
+//	client has replies pending, it isn't read from, so a client that sends
+//	requests without reading the replies only slows itself down.  One that
+//	lets more than CONTROL_OUTPUT_MAX bytes pile up anyway is disconnected.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+//
+#include "control.h"
+#include "trace.h"
+
+#define CONTROL_READ_BUDGET	65536
+#define CLIENT_READ_SIZE	4096
+#define CONTROL_OUTPUT_MAX	(1 << 20)
+
+//	Partial line carried over from one read to the next
+using LineReader = struct {
+	char line[CONTROL_LINE_MAX + 1];
+	unsigned int length;
+	bool tooLong;
+};
+
+using ControlClient = struct {
+	int fd;
+	LineReader reader;
+	char* output;
+	size_t outputLength, outputCapacity;
+	bool writing;				//	registered for EPOLLOUT rather than EPOLLIN
+};
+
+static int controlFd = -1, listenFd = -1, epollFd = -1, wakeFd[2] = {-1, -1};
+static char socketPath[108];
+static pthread_t controlID;
+static bool controlRunning = false;
+
+static LineReader fifoReader;
+static ControlClient* clients[CONTROL_MAX_CLIENTS];
+
+static void* controlThreadFunc(void* arg);
+static bool listenOn(const char* path);
+static void acceptClients(void);
+static bool serveClient(ControlClient* client, unsigned int events);
+static void closeClient(ControlClient* client);
+static bool readCommands(int fd, LineReader* reader, ControlClient* client, size_t budget, bool* gone);
+static bool queueReply(ControlClient* client, const char* reply);
+static bool flushReplies(ControlClient* client);
+static void watch(int fd, unsigned int events, int op);
+
+
+bool startControlChannel(const char* fifoPath, const char* socketPath)
+{
+	//	the pipe lets stopControlChannel wake the thread up
+	epollFd = epoll_create1(0);
+	if (epollFd < 0 || pipe(wakeFd) < 0)
+	{
+		std::cerr << "ERROR: cannot set up the control loop: " << strerror(errno) << std::endl;
+		return false;
+	}
+	watch(wakeFd[0], EPOLLIN, EPOLL_CTL_ADD);
+
+	if (fifoPath != nullptr)
+	{
+		struct stat info;
+		if (stat(fifoPath, &info) < 0 && mkfifo(fifoPath, 0600) < 0)
+		{
+			std::cerr << "ERROR: cannot create " << fifoPath << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		controlFd = open(fifoPath, O_RDWR | O_NONBLOCK);
+		if (controlFd < 0)
+		{
+			std::cerr << "ERROR: cannot open " << fifoPath << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		watch(controlFd, EPOLLIN, EPOLL_CTL_ADD);
+	}
+	if (socketPath != nullptr && !listenOn(socketPath))
+		return false;
+
+	controlRunning = true;
+	if (pthread_create(&controlID, nullptr, controlThreadFunc, nullptr) != 0)
+	{
+		std::cerr << "ERROR: Failed to create the control thread" << std::endl;
+		controlRunning = false;
+		return false;
+	}
+	return true;
+}
+
+
+void stopControlChannel(void)
+{
+	if (!controlRunning)
+		return;
+	if (!pthread_equal(pthread_self(), controlID))
+	{
+		char c = 0;
+		if (write(wakeFd[1], &c, 1) == 1)
+			pthread_join(controlID, nullptr);
+	}
+	for (unsigned int k=0; k<CONTROL_MAX_CLIENTS; k++)
+		if (clients[k] != nullptr)
+			closeClient(clients[k]);
+	if (controlFd >= 0)
+		close(controlFd);
+	if (listenFd >= 0)
+	{
+		close(listenFd);
+		unlink(socketPath);
+	}
+	close(epollFd);
+	close(wakeFd[0]);
+	close(wakeFd[1]);
+	controlFd = listenFd = epollFd = wakeFd[0] = wakeFd[1] = -1;
+	controlRunning = false;
+}
+
+
+static void* controlThreadFunc(void* arg)
+{
+	(void) arg;
+	traceThread("control");
+
+	const int MAX_EVENTS = 16;
+	struct epoll_event events[MAX_EVENTS];
+	bool keepGoing = true;
+	while (keepGoing)
+	{
+		int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			std::cerr << "ERROR: control loop: " << strerror(errno) << std::endl;
+			break;
+		}
+		for (int k=0; k<n && keepGoing; k++)
+		{
+			int fd = events[k].data.fd;
+			if (fd == wakeFd[0])
+				keepGoing = false;
+			else if (fd == controlFd)
+			{
+				bool gone;
+				keepGoing = readCommands(controlFd, &fifoReader, nullptr, CONTROL_READ_BUDGET, &gone);
+			}
+			else if (fd == listenFd)
+				acceptClients();
+			else
+			{
+				for (unsigned int c=0; c<CONTROL_MAX_CLIENTS; c++)
+					if (clients[c] != nullptr && clients[c]->fd == fd)
+					{
+						keepGoing = serveClient(clients[c], events[k].events);
+						break;
+					}
+			}
+		}
+	}
+	return nullptr;
+}
+
+//	A socket left behind by a previous run is replaced
+static bool listenOn(const char* path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		std::cerr << "ERROR: socket path too long: " << path << std::endl;
+		return false;
+	}
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	snprintf(socketPath, sizeof(socketPath), "%s", path);
+	unlink(path);
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd < 0 || bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+		chmod(path, 0600) < 0 || listen(listenFd, 16) < 0)
+	{
+		std::cerr << "ERROR: cannot listen on " << path << ": " << strerror(errno) << std::endl;
+		if (listenFd >= 0)
+			close(listenFd);
+		listenFd = -1;
+		return false;
+	}
+	watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+	return true;
+}
+
+static void acceptClients(void)
+{
+	int fd;
+	while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		unsigned int k = 0;
+		while (k < CONTROL_MAX_CLIENTS && clients[k] != nullptr)
+			k++;
+		if (k == CONTROL_MAX_CLIENTS)
+		{
+			const char* reply = "error too many clients\n";
+			if (write(fd, reply, strlen(reply)) < 0) {}
+			close(fd);
+			continue;
+		}
+		ControlClient* client = static_cast<ControlClient*>(calloc(1, sizeof(ControlClient)));
+		client->fd = fd;
+		clients[k] = client;
+		watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+	}
+}
+
+//	Returns false if a command asked to close the control channel
+static bool serveClient(ControlClient* client, unsigned int events)
+{
+	bool gone = false, keepGoing = true;
+	if (client->writing)
+		gone = (events & (EPOLLERR | EPOLLHUP)) != 0;
+	else
+		keepGoing = readCommands(client->fd, &client->reader, client, CLIENT_READ_SIZE, &gone);
+
+	//	replies to the last requests of a client that is leaving still go out
+	if (!flushReplies(client) || gone)
+		closeClient(client);
+	else if (client->writing != (client->outputLength > 0))
+	{
+		client->writing = client->outputLength > 0;
+		watch(client->fd, client->writing ? EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+	}
+	return keepGoing;
+}
+
+static void closeClient(ControlClient* client)
+{
+	for (unsigned int k=0; k<CONTROL_MAX_CLIENTS; k++)
+		if (clients[k] == client)
+			clients[k] = nullptr;
+	close(client->fd);
+	free(client->output);
+	free(client);
+}
+
+//	Reads what is available (within the budget) and handles every complete
+//	line, replying to the client if there is one.  Sets gone if the other
+//	end closed the connection.  Returns false if a command asked to close
+//	the channel.
+static bool readCommands(int fd, LineReader* reader, ControlClient* client, size_t budget, bool* gone)
+{
+	char buf[4096];
+	*gone = false;
+	while (budget > 0)
+	{
+		ssize_t size = read(fd, buf, sizeof(buf) < budget ? sizeof(buf) : budget);
+		if (size == 0 || (size < 0 && errno != EAGAIN && errno != EINTR))
+			*gone = true;
+		if (size <= 0)
+			break;
+		budget -= size;
+
+		for (ssize_t k=0; k<size; k++)
+		{
+			if (buf[k] != '\n')
+			{
+				if (reader->length < CONTROL_LINE_MAX)
+					reader->line[reader->length++] = buf[k];
+				else
+					reader->tooLong = true;
+				continue;
+			}
+
+			//	end of a command
+			char* line = reader->line;
+			line[reader->length] = '\0';
+			//	tolerate DOS line ends
+			if (reader->length > 0 && line[reader->length-1] == '\r')
+				line[reader->length-1] = '\0';
+			bool tooLong = reader->tooLong;
+			reader->length = 0;
+			reader->tooLong = false;
+			if (line[0] == '\0' && !tooLong)
+				continue;
+
+			char reply[CONTROL_REPLY_MAX];
+			bool keepGoing = true;
+			if (tooLong)
+				snprintf(reply, sizeof(reply), "error command longer than %d characters", CONTROL_LINE_MAX);
+			else
+				keepGoing = handleCommand(line, reply, sizeof(reply));
+
+			//	FIFO writers can't be answered: only errors are shown
+			if (client == nullptr)
+			{
+				if (!strncmp(reply, "error", 5))
+					std::cerr << reply << std::endl;
+			}
+			else if (!queueReply(client, reply))
+			{
+				std::cerr << "Control client not reading its replies: disconnected" << std::endl;
+				*gone = true;
+				return keepGoing;
+			}
+			if (!keepGoing)
+			{
+				if (client != nullptr)
+					flushReplies(client);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool queueReply(ControlClient* client, const char* reply)
+{
+	size_t length = strlen(reply);
+	size_t needed = client->outputLength + length + 1;
+	if (needed > CONTROL_OUTPUT_MAX)
+		return false;
+	if (needed > client->outputCapacity)
+	{
+		size_t capacity = client->outputCapacity > 0 ? client->outputCapacity : 4096;
+		while (capacity < needed)
+			capacity *= 2;
+		char* output = static_cast<char*>(realloc(client->output, capacity));
+		if (output == nullptr)
+			return false;
+		client->output = output;
+		client->outputCapacity = capacity;
+	}
+	memcpy(client->output + client->outputLength, reply, length);
+	client->output[client->outputLength + length] = '\n';
+	client->outputLength = needed;
+	return true;
+}
+
+//	Writes as much of the pending replies as the socket takes.  Returns
+//	false if the connection is broken.
+static bool flushReplies(ControlClient* client)
+{
+	size_t written = 0;
+	while (written < client->outputLength)
+	{
+		ssize_t n = send(client->fd, client->output + written, client->outputLength - written, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return false;
+		}
+		written += n;
+	}
+	memmove(client->output, client->output + written, client->outputLength - written);
+	client->outputLength -= written;
+	return true;
+}
+
+static void watch(int fd, unsigned int events, int op)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.fd = fd;
+	epoll_ctl(epollFd, op, fd, &event);
+}
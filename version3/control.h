@@ -0,0 +1,41 @@
+//
+//  control.h
+//  Cellular Automaton
+//
+//	Control channel: a thread waits (epoll) on a FIFO that is kept open for
+//	the whole run and on a Unix domain socket, splits what it reads into
+//	lines, and hands each line to the application as a command.
+//		- FIFO writers can come and go (echo "rule 2" > /tmp/pipe) and send
+//			any number of commands at once, but get no answer.
+//		- Socket clients (up to CONTROL_MAX_CLIENTS at once) get one line
+//			back for every line they send: "ok", "error <reason>", or the
+//			answer to a query.
+//
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <cstddef>
+
+//	Longest command accepted, newline excluded.  Longer lines are discarded.
+#define CONTROL_LINE_MAX	1024
+
+//	Longest reply, newline excluded
+#define CONTROL_REPLY_MAX	1024
+
+#define CONTROL_MAX_CLIENTS	64
+
+//	Opens the FIFO (creating it if needed) and/or listens on the socket
+//	(either path can be nullptr), then starts the control thread.  Returns
+//	false on failure.
+bool startControlChannel(const char* fifoPath, const char* socketPath);
+
+//	Stops the control thread, closes the FIFO, the socket and the clients
+void stopControlChannel(void);
+
+//	Implemented by the application: handles one command (without its
+//	newline) and writes the reply in reply (without a newline).  Returns
+//	false to close the control channel.
+bool handleCommand(const char* line, char* reply, size_t replySize);
+
+#endif // CONTROL_H
@@ -0,0 +1,333 @@
+//
+//  deltaStream.cpp
+//  Cellular Automaton
+//
+//	The records form a ring of DELTA_RECORDS, each with one DeltaBand per
+//	possible worker.  The band buffers grow as needed and are kept from one
+//	use of the record to the next, so that after the first few generations
+//	the workers no longer allocate anything.  The writer sends a record
+//	with a single writev: its header, then the bands in order.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+//
+#include "deltaStream.h"
+
+#define RECORD_HEADER_SIZE	16
+#define MAX_DELTA_BANDS		1000	//	bands + header must fit in one writev
+
+struct DeltaRecord {
+	unsigned char header[RECORD_HEADER_SIZE];
+	DeltaBand* bands;
+	unsigned int numBands;
+};
+
+//---------------------------------------------------------------------------
+//  File-level global variables
+//---------------------------------------------------------------------------
+
+static const char* outputPath = nullptr;
+static unsigned int deltaRows = 0, deltaCols = 0, deltaMaxBands = 0;
+static DeltaRecord records[DELTA_RECORDS];
+
+//	recordsPublished is only advanced by the last worker of a generation,
+//	recordsWritten only by the writer thread, both under recordLock
+static unsigned long recordsPublished = 0, recordsWritten = 0;
+static DeltaRecord* recordFilling = nullptr;
+static bool outputOpen = false, outputFailed = false, streamClosing = false;
+static pthread_mutex_t recordLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t recordsChanged = PTHREAD_COND_INITIALIZER;
+static pthread_t writerID;
+static int outputFd = -1;
+
+static unsigned long bytesWritten = 0, numWaits = 0;
+
+static void* deltaWriterFunc(void* arg);
+static bool writeAll(int fd, struct iovec* iov, int numIov);
+static void appendWord(DeltaBand* band, unsigned int word);
+static void putInt(unsigned char* dst, unsigned long value, int numBytes);
+
+
+bool initDeltaStream(const char* path, unsigned int numRows, unsigned int numCols,
+					 unsigned int maxBands)
+{
+	if (maxBands > MAX_DELTA_BANDS)
+	{
+		std::cerr << "ERROR: the delta stream supports at most " << MAX_DELTA_BANDS << " threads" << std::endl;
+		return false;
+	}
+	outputPath = path;
+	deltaRows = numRows;
+	deltaCols = numCols;
+	deltaMaxBands = maxBands;
+	for (int r=0; r<DELTA_RECORDS; r++)
+		records[r].bands = static_cast<DeltaBand*>(calloc(maxBands, sizeof(DeltaBand)));
+
+	//	a reader that goes away must not kill the simulation
+	signal(SIGPIPE, SIG_IGN);
+
+	//	Anything but a FIFO is opened right away, so that errors show up now
+	struct stat info;
+	bool isFifo = strcmp(path, "-") != 0 && stat(path, &info) == 0 && S_ISFIFO(info.st_mode);
+	if (!isFifo)
+	{
+		outputFd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (outputFd < 0)
+		{
+			std::cerr << "ERROR: cannot write to " << path << ": " << strerror(errno) << std::endl;
+			outputPath = nullptr;
+			return false;
+		}
+	}
+	if (pthread_create(&writerID, nullptr, deltaWriterFunc, nullptr) != 0)
+	{
+		std::cerr << "ERROR: Failed to create the delta writer thread" << std::endl;
+		outputPath = nullptr;
+		return false;
+	}
+	return true;
+}
+
+
+void publishDeltas(unsigned int numBands)
+{
+	if (recordFilling == nullptr)
+		return;
+	recordFilling->numBands = numBands;
+	size_t payload = 0;
+	for (unsigned int k=0; k<numBands; k++)
+		payload += recordFilling->bands[k].size * sizeof(unsigned int);
+	putInt(recordFilling->header + 8, payload, 8);
+	recordFilling = nullptr;
+
+	pthread_mutex_lock(&recordLock);
+	recordsPublished++;
+	pthread_cond_broadcast(&recordsChanged);
+	pthread_mutex_unlock(&recordLock);
+}
+
+
+DeltaRecord* beginDeltas(int generation)
+{
+	if (outputPath == nullptr)
+		return nullptr;
+
+	//	this is where a slow reader slows down the simulation
+	pthread_mutex_lock(&recordLock);
+	if (recordsPublished - recordsWritten >= DELTA_RECORDS && !outputFailed)
+		numWaits++;
+	while (recordsPublished - recordsWritten >= DELTA_RECORDS && !outputFailed)
+		pthread_cond_wait(&recordsChanged, &recordLock);
+	bool failed = outputFailed;
+	DeltaRecord* record = records + recordsPublished % DELTA_RECORDS;
+	pthread_mutex_unlock(&recordLock);
+	if (failed)
+		return nullptr;
+
+	memcpy(record->header, "CADG", 4);
+	putInt(record->header + 4, (unsigned int) generation, 4);
+	for (unsigned int k=0; k<deltaMaxBands; k++)
+		record->bands[k].size = 0;
+	recordFilling = record;
+	return record;
+}
+
+
+DeltaBand* deltaBand(DeltaRecord* record, unsigned int band)
+{
+	return record->bands + band;
+}
+
+
+void beginDeltaRow(DeltaBand* band, unsigned int i)
+{
+	band->rowStart = band->size;
+	appendWord(band, i);
+	appendWord(band, 0);
+}
+
+
+void addDeltaRun(DeltaBand* band, unsigned int firstCol, unsigned int length)
+{
+	appendWord(band, firstCol);
+	appendWord(band, length);
+	band->data[band->rowStart + 1]++;
+}
+
+
+void endDeltaRow(DeltaBand* band)
+{
+	//	no runs: take the row header back
+	if (band->data[band->rowStart + 1] == 0)
+		band->size = band->rowStart;
+}
+
+
+void writeDeltaKeyframe(unsigned int** grid, unsigned int firstRow, unsigned int lastRow,
+						int generation)
+{
+	DeltaRecord* record = beginDeltas(generation);
+	if (record == nullptr)
+		return;
+	memcpy(record->header, "CADK", 4);
+	DeltaBand* band = record->bands;
+	for (unsigned int i=firstRow; i<=lastRow; i++)
+	{
+		beginDeltaRow(band, i);
+		unsigned int runStart = 0;
+		bool inRun = false;
+		for (unsigned int j=0; j<deltaCols; j++)
+		{
+			bool alive = grid[i][j] != 0;
+			if (alive != inRun)
+			{
+				if (alive)
+					runStart = j;
+				else
+					addDeltaRun(band, runStart, j - runStart);
+				inRun = alive;
+			}
+		}
+		if (inRun)
+			addDeltaRun(band, runStart, deltaCols - runStart);
+		endDeltaRow(band);
+	}
+	publishDeltas(1);
+}
+
+
+void closeDeltaStream(void)
+{
+	if (outputPath == nullptr)
+		return;
+	pthread_mutex_lock(&recordLock);
+	streamClosing = true;
+	//	a FIFO that never got a reader still blocks the writer in open
+	if (!outputOpen)
+		pthread_cancel(writerID);
+	pthread_cond_broadcast(&recordsChanged);
+	pthread_mutex_unlock(&recordLock);
+	pthread_join(writerID, nullptr);
+	fprintf(stderr, "deltas: %lu records, %lu bytes written, %lu waits for the reader\n",
+			recordsWritten, bytesWritten, numWaits);
+	outputPath = nullptr;
+}
+
+
+static void* deltaWriterFunc(void* arg)
+{
+	(void) arg;
+
+	//	opening a FIFO blocks until there is a reader
+	int fd = outputFd >= 0 ? outputFd : open(outputPath, O_WRONLY);
+	unsigned char header[12];
+	memcpy(header, "CADS", 4);
+	putInt(header + 4, deltaRows, 4);
+	putInt(header + 8, deltaCols, 4);
+	struct iovec headerIov = {header, sizeof(header)};
+	bool ok = fd >= 0 && writeAll(fd, &headerIov, 1);
+
+	pthread_mutex_lock(&recordLock);
+	outputOpen = true;
+	struct iovec* iov = new struct iovec[deltaMaxBands + 1];
+	while (ok)
+	{
+		while (recordsWritten == recordsPublished && !streamClosing)
+			pthread_cond_wait(&recordsChanged, &recordLock);
+		if (recordsWritten == recordsPublished)
+			break;
+		DeltaRecord* record = records + recordsWritten % DELTA_RECORDS;
+		pthread_mutex_unlock(&recordLock);
+
+		iov[0].iov_base = record->header;
+		iov[0].iov_len = RECORD_HEADER_SIZE;
+		int numIov = 1;
+		for (unsigned int k=0; k<record->numBands; k++)
+		{
+			if (record->bands[k].size == 0)
+				continue;
+			iov[numIov].iov_base = record->bands[k].data;
+			iov[numIov].iov_len = record->bands[k].size * sizeof(unsigned int);
+			numIov++;
+		}
+		ok = writeAll(fd, iov, numIov);
+
+		pthread_mutex_lock(&recordLock);
+		recordsWritten++;
+		pthread_cond_broadcast(&recordsChanged);
+	}
+	//	don't leave the simulation waiting for a writer that is gone
+	if (!ok)
+	{
+		outputFailed = true;
+		pthread_cond_broadcast(&recordsChanged);
+		std::cerr << "ERROR: delta output " << outputPath << " failed: " << strerror(errno) << std::endl;
+	}
+	pthread_mutex_unlock(&recordLock);
+	delete []iov;
+
+	if (fd >= 0 && fd != STDOUT_FILENO)
+		close(fd);
+	return nullptr;
+}
+
+static bool writeAll(int fd, struct iovec* iov, int numIov)
+{
+	while (numIov > 0)
+	{
+		ssize_t n = writev(fd, iov, numIov);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		bytesWritten += n;
+		//	skip what was written
+		while (numIov > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			numIov--;
+		}
+		if (numIov > 0)
+		{
+			iov->iov_base = (char*) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return true;
+}
+
+static void appendWord(DeltaBand* band, unsigned int word)
+{
+	if (band->size == band->capacity)
+	{
+		size_t capacity = band->capacity > 0 ? 2 * band->capacity : 1024;
+		unsigned int* data = static_cast<unsigned int*>(realloc(band->data, capacity * sizeof(unsigned int)));
+		if (data == nullptr)
+		{
+			std::cerr << "ERROR: out of memory for the delta stream" << std::endl;
+			exit(1);
+		}
+		band->data = data;
+		band->capacity = capacity;
+	}
+	band->data[band->size++] = word;
+}
+
+static void putInt(unsigned char* dst, unsigned long value, int numBytes)
+{
+	for (int k=0; k<numBytes; k++)
+		dst[k] = (unsigned char) (value >> (8*k));
+}
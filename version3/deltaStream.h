@@ -0,0 +1,77 @@
+//
+//  deltaStream.h
+//  Cellular Automaton
+//
+//	Output of the cells that flipped (dead to alive or alive to dead) at
+//	each generation, for analysis tools that don't need whole frames.  Each
+//	worker lists the flips of its band as it computes it, and the last
+//	worker of a generation hands the bands, in row order, to a writer
+//	thread that writes them as one record.
+//
+//	Unlike frames, records are never dropped, since a gap would leave the
+//	reader with a wrong grid: when the writer falls DELTA_RECORDS records
+//	behind, the simulation waits for it.
+//
+//	Stream layout (integers are 32 bits unless noted, little endian in the
+//	headers, in the byte order of the machine in the payload):
+//		- stream header: "CADS", numRows, numCols
+//		- records: "CADG" (flips since the previous record) or "CADK" (the
+//			live cells of the whole grid), generation, payload size in bytes
+//			(64 bits), then the payload
+//		- payload: for each row with at least one cell listed, in increasing
+//			order: row, number of runs, then (first column, length) of each
+//			run of consecutive cells
+//
+//	The stream starts with a "CADK" record of the initial grid, and another
+//	one is written whenever the grid is replaced (reset, clear, load,
+//	pattern).
+//
+
+#ifndef DELTA_STREAM_H
+#define DELTA_STREAM_H
+
+#include <cstddef>
+
+#define DELTA_RECORDS	4
+
+//	The flips of one band, filled by its worker only
+typedef struct DeltaBand {
+	unsigned int* data;
+	size_t size, capacity;		//	in 32-bit words
+	size_t rowStart;			//	where the header of the current row is
+} DeltaBand;
+
+typedef struct DeltaRecord DeltaRecord;
+
+//	Starts the writer thread, which opens the output (a file, a FIFO or -
+//	for stdout) and writes the stream header.  maxBands is the largest
+//	number of bands a record can have.  Returns false on failure.
+bool initDeltaStream(const char* path, unsigned int numRows, unsigned int numCols,
+					 unsigned int maxBands);
+
+//	Both called by the last worker to finish a generation.  publishDeltas
+//	hands the record that the workers just filled to the writer, with its
+//	first numBands bands.  beginDeltas returns the record the workers fill
+//	while computing the given generation, waiting for the writer if no
+//	record is free; nullptr if there is no delta stream (or it failed).
+void publishDeltas(unsigned int numBands);
+DeltaRecord* beginDeltas(int generation);
+
+DeltaBand* deltaBand(DeltaRecord* record, unsigned int band);
+
+//	Called by the worker of a band, for each row it computes: the runs of
+//	flipped cells of row i are added in increasing column order between
+//	beginDeltaRow and endDeltaRow.  Rows without runs take no space.
+void beginDeltaRow(DeltaBand* band, unsigned int i);
+void addDeltaRun(DeltaBand* band, unsigned int firstCol, unsigned int length);
+void endDeltaRow(DeltaBand* band);
+
+//	Writes a "CADK" record of rows firstRow to lastRow of grid.  Same
+//	caller as publishDeltas, between publishDeltas and beginDeltas.
+void writeDeltaKeyframe(unsigned int** grid, unsigned int firstRow, unsigned int lastRow,
+						int generation);
+
+//	Waits for the pending records to be written, and reports the counters
+void closeDeltaStream(void);
+
+#endif // DELTA_STREAM_H
@@ -0,0 +1,210 @@
+//
+//  ensemble.cpp
+//  Cellular Automaton
+//
+//	Each worker thread owns a pair of scratch grids and runs one soup at a
+//	time to completion, picking the next soup index from a shared atomic
+//	counter.  A soup is considered stable as soon as its state repeats one
+//	of the last STABILITY_WINDOW states (still life or oscillator of short
+//	period).  The states are compared by hash first, and a hash hit is
+//	confirmed by comparing the states themselves, which each worker keeps
+//	for the window.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <pthread.h>
+//
+#include "ensemble.h"
+
+#define STABILITY_WINDOW	16
+
+//---------------------------------------------------------------------------
+//  Implemented in main.cpp
+//---------------------------------------------------------------------------
+
+unsigned int cellNewStateIn(unsigned int** grid, unsigned int nRows, unsigned int nCols,
+							unsigned int gridRule, unsigned int i, unsigned int j);
+double currentTime(void);
+unsigned long seedRandom(unsigned int seed);
+unsigned int nextRandomFrom(unsigned long* state);
+
+//---------------------------------------------------------------------------
+//  Custom data types
+//---------------------------------------------------------------------------
+
+using SoupResult = struct {
+	unsigned int seed;
+	unsigned long initialPopulation;
+	unsigned long finalPopulation;
+	//	generation at which the repeating cycle started, and its period
+	//	(0 if the soup was still evolving after maxGenerations)
+	unsigned int stabilizationGeneration;
+	unsigned int period;
+	unsigned int generations;
+};
+
+using EnsembleJob = struct {
+	unsigned int numGrids, numRows, numCols;
+	unsigned int maxGenerations, rule, seed;
+	std::atomic<unsigned int> nextGrid;
+	SoupResult* results;
+};
+
+static void* ensembleThreadFunc(void* arg);
+static void runSoup(const EnsembleJob* job, unsigned int** cur, unsigned int** next,
+					unsigned char* states, SoupResult* result);
+static unsigned long hashGrid(unsigned int** grid, unsigned int numRows, unsigned int numCols,
+							  unsigned char* state, unsigned long* population);
+static unsigned int** allocateGrid(unsigned int numRows, unsigned int numCols);
+static void freeGrid(unsigned int** grid, unsigned int numRows);
+
+
+void runEnsemble(unsigned int numGrids, unsigned int numRows, unsigned int numCols,
+				 unsigned int numThreads, unsigned int maxGenerations,
+				 unsigned int rule, unsigned int seed)
+{
+	EnsembleJob job;
+	job.numGrids = numGrids;
+	job.numRows = numRows;
+	job.numCols = numCols;
+	job.maxGenerations = maxGenerations;
+	job.rule = rule;
+	job.seed = seed;
+	job.nextGrid = 0;
+	job.results = new SoupResult[numGrids];
+
+	if (numThreads > numGrids)
+		numThreads = numGrids;
+	double startTime = currentTime();
+	pthread_t* threadID = new pthread_t[numThreads];
+	for (unsigned int k = 0; k < numThreads; k++) {
+		int error_code = pthread_create(threadID + k, nullptr, ensembleThreadFunc, &job);
+		if (error_code != 0) {
+			std::cerr << "ERROR: Failed to create ensemble thread with error code " << error_code << std::endl;
+			exit(1);
+		}
+	}
+	for (unsigned int k = 0; k < numThreads; k++)
+		pthread_join(threadID[k], nullptr);
+	double elapsed = currentTime() - startTime;
+
+	unsigned long totalGenerations = 0;
+	printf("grid,seed,initial_population,final_population,stabilization_generation,period,generations\n");
+	for (unsigned int g = 0; g < numGrids; g++) {
+		const SoupResult& r = job.results[g];
+		printf("%u,%u,%lu,%lu,%u,%u,%u\n", g, r.seed, r.initialPopulation, r.finalPopulation,
+			   r.stabilizationGeneration, r.period, r.generations);
+		totalGenerations += r.generations;
+	}
+	fprintf(stderr, "%u grids, %lu generations in %.3f s (%.0f cell updates/s)\n", numGrids,
+			totalGenerations, elapsed, elapsed > 0. ? (double) totalGenerations * numRows * numCols / elapsed : 0.);
+
+	delete []threadID;
+	delete []job.results;
+}
+
+
+static void* ensembleThreadFunc(void* arg)
+{
+	EnsembleJob* job = static_cast<EnsembleJob*>(arg);
+	unsigned int** cur = allocateGrid(job->numRows, job->numCols);
+	unsigned int** next = allocateGrid(job->numRows, job->numCols);
+	//	live/dead state of the last generations, one more than the window
+	//	(the current one)
+	unsigned char* states = new unsigned char[(STABILITY_WINDOW + 1) * job->numRows * job->numCols];
+
+	for (unsigned int g = job->nextGrid++; g < job->numGrids; g = job->nextGrid++) {
+		job->results[g].seed = job->seed + g;
+		runSoup(job, cur, next, states, job->results + g);
+	}
+
+	freeGrid(cur, job->numRows);
+	freeGrid(next, job->numRows);
+	delete []states;
+	return nullptr;
+}
+
+static void runSoup(const EnsembleJob* job, unsigned int** cur, unsigned int** next,
+					unsigned char* states, SoupResult* result)
+{
+	const unsigned int numRows = job->numRows, numCols = job->numCols;
+	const size_t stateSize = (size_t) numRows * numCols;
+
+	//	the generator of resetGrid, with a state of our own, so that soups
+	//	don't depend on scheduling
+	unsigned long randState = seedRandom(result->seed);
+	for (unsigned int i = 0; i < numRows; i++)
+		for (unsigned int j = 0; j < numCols; j++)
+			cur[i][j] = nextRandomFrom(&randState) % 2;
+
+	unsigned long history[STABILITY_WINDOW + 1];
+	unsigned long population;
+	history[0] = hashGrid(cur, numRows, numCols, states, &population);
+	result->initialPopulation = population;
+	result->stabilizationGeneration = 0;
+	result->period = 0;
+
+	unsigned int gen;
+	for (gen = 1; gen <= job->maxGenerations; gen++) {
+		for (unsigned int i = 0; i < numRows; i++)
+			for (unsigned int j = 0; j < numCols; j++)
+				next[i][j] = cellNewStateIn(cur, numRows, numCols, job->rule, i, j);
+		unsigned int** temp = cur;
+		cur = next;
+		next = temp;
+
+		const unsigned int slot = gen % (STABILITY_WINDOW + 1);
+		unsigned char* state = states + slot * stateSize;
+		unsigned long hash = hashGrid(cur, numRows, numCols, state, &population);
+		for (unsigned int p = 1; p <= STABILITY_WINDOW && p <= gen; p++) {
+			const unsigned int other = (gen - p) % (STABILITY_WINDOW + 1);
+			if (history[other] == hash && memcmp(states + other * stateSize, state, stateSize) == 0) {
+				result->stabilizationGeneration = gen - p;
+				result->period = p;
+				break;
+			}
+		}
+		history[slot] = hash;
+		if (result->period != 0)
+			break;
+	}
+	result->generations = gen > job->maxGenerations ? job->maxGenerations : gen;
+	result->finalPopulation = population;
+}
+
+//	FNV-1a hash of the live/dead state of the grid, computed along with
+//	the population, as the state is copied to state
+static unsigned long hashGrid(unsigned int** grid, unsigned int numRows, unsigned int numCols,
+							  unsigned char* state, unsigned long* population)
+{
+	unsigned long hash = 14695981039346656037UL;
+	unsigned long count = 0;
+	for (unsigned int i = 0; i < numRows; i++)
+		for (unsigned int j = 0; j < numCols; j++) {
+			unsigned int alive = grid[i][j] != 0;
+			*state++ = (unsigned char) alive;
+			count += alive;
+			hash = (hash ^ alive) * 1099511628211UL;
+		}
+	*population = count;
+	return hash;
+}
+
+static unsigned int** allocateGrid(unsigned int numRows, unsigned int numCols)
+{
+	unsigned int** grid = new unsigned int*[numRows];
+	for (unsigned int i = 0; i < numRows; i++)
+		grid[i] = new unsigned int[numCols];
+	return grid;
+}
+
+static void freeGrid(unsigned int** grid, unsigned int numRows)
+{
+	for (unsigned int i = 0; i < numRows; i++)
+		delete []grid[i];
+	delete []grid;
+}
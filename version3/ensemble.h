@@ -0,0 +1,22 @@
+//
+//  ensemble.h
+//  Cellular Automaton
+//
+//	Headless runner for many independent small grids (random soups) packed
+//	in one process.  Whole grids, rather than bands, are handed out to the
+//	worker threads, so no barrier is needed between generations.
+//
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+//	Runs numGrids random soups of numRows x numCols cells under the given
+//	rule, for at most maxGenerations generations each, and prints one CSV
+//	line of summary statistics per grid on stdout.  Grid k is seeded with
+//	seed + k, like the soup of a normal run, so that any single soup can be
+//	reproduced (e.g. interactively, with --seed seed+k and the same size).
+void runEnsemble(unsigned int numGrids, unsigned int numRows, unsigned int numCols,
+				 unsigned int numThreads, unsigned int maxGenerations,
+				 unsigned int rule, unsigned int seed);
+
+#endif // ENSEMBLE_H
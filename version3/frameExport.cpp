@@ -0,0 +1,294 @@
+//
+//  frameExport.cpp
+//  Cellular Automaton
+//
+//	Frames go through a ring of slots, each holding a frame header followed
+//	by the cells, in one page-aligned buffer.  The last worker to finish a
+//	generation claims the next slot (or drops the frame if the ring is
+//	full), the workers fill it, and it is published at the next generation
+//	boundary.  The writer thread writes published slots in order.
+//
+//	When the output is a pipe, the slots are vmspliced into it, i.e. the
+//	pipe references the slot's pages instead of copying them.  A slot can
+//	then only be reused once the reader has consumed it: with a pipe of
+//	capacity C and slots of S bytes, once a slot has been fully spliced at
+//	most C bytes remain in the pipe, so the slot written heldBack =
+//	C/S + 1 slots earlier is gone from the pipe.  Other outputs (files) are
+//	written with writev, which leaves the slot free as soon as it returns.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+//
+#include "gl_frontEnd.h"
+#include "frameExport.h"
+
+#define FRAME_HEADER_SIZE	8
+#define STREAM_HEADER_SIZE	(20 + 4*NB_COLORS)
+#define MAX_FRAME_SLOTS		16
+
+//---------------------------------------------------------------------------
+//  File-level global variables
+//---------------------------------------------------------------------------
+
+static const char* outputPath = nullptr;
+static unsigned int frameRows = 0, frameCols = 0, frameEvery = 1;
+static int frameFormat = FRAME_FORMAT_INDEXED;
+static size_t rowBytes = 0, slotSize = 0;
+
+//	The ring of slots is only set up by the writer thread once it knows
+//	what the output is.  Until then (exportReady false) frames are dropped.
+static unsigned char* slotBuffer[MAX_FRAME_SLOTS];
+static unsigned int numSlots = 0, heldBack = 0;
+static bool useSplice = false;
+static std::atomic<bool> exportReady(false), exportClosing(false);
+
+//	slotsPublished is only advanced by the last worker of a generation,
+//	slotsReleased only by the writer thread
+static std::atomic<unsigned long> slotsPublished(0), slotsReleased(0);
+static bool slotFilling = false;
+static sem_t framesReady;
+static pthread_t writerID;
+static int outputFd = -1;
+
+static std::atomic<unsigned long> framesWritten(0), framesDropped(0);
+
+static void* frameWriterFunc(void* arg);
+static bool setUpOutput(int fd);
+static bool writeSlot(int fd, unsigned char* slot);
+static void putInt(unsigned char* dst, unsigned int value);
+
+
+bool initFrameExport(const char* path, unsigned int numRows, unsigned int numCols,
+					 unsigned int every, int format)
+{
+	outputPath = path;
+	frameRows = numRows;
+	frameCols = numCols;
+	frameEvery = every > 0 ? every : 1;
+	frameFormat = format;
+	rowBytes = format == FRAME_FORMAT_PACKED ? (numCols + 7) / 8 : numCols;
+	slotSize = FRAME_HEADER_SIZE + rowBytes * numRows;
+
+	//	a reader that goes away must not kill the simulation
+	signal(SIGPIPE, SIG_IGN);
+
+	//	Anything but a FIFO is opened right away, so that no frame is lost
+	//	at the start of the run
+	struct stat info;
+	bool isFifo = strcmp(path, "-") != 0 && stat(path, &info) == 0 && S_ISFIFO(info.st_mode);
+	if (!isFifo)
+	{
+		outputFd = strcmp(path, "-") == 0 ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (outputFd < 0 || !setUpOutput(outputFd))
+		{
+			std::cerr << "ERROR: cannot write to " << path << ": " << strerror(errno) << std::endl;
+			outputPath = nullptr;
+			return false;
+		}
+	}
+	sem_init(&framesReady, 0, 0);
+	if (pthread_create(&writerID, nullptr, frameWriterFunc, nullptr) != 0)
+	{
+		std::cerr << "ERROR: Failed to create the frame writer thread" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+
+void publishFrame(void)
+{
+	if (!slotFilling)
+		return;
+	slotFilling = false;
+	slotsPublished.fetch_add(1, std::memory_order_release);
+	sem_post(&framesReady);
+}
+
+
+unsigned char* beginFrame(int generation)
+{
+	if (outputPath == nullptr || generation % frameEvery != 0)
+		return nullptr;
+
+	unsigned long n = slotsPublished.load(std::memory_order_relaxed);
+	if (!exportReady.load(std::memory_order_acquire) ||
+		n - slotsReleased.load(std::memory_order_acquire) >= numSlots)
+	{
+		framesDropped++;
+		return nullptr;
+	}
+
+	unsigned char* slot = slotBuffer[n % numSlots];
+	memcpy(slot, "CAFR", 4);
+	putInt(slot + 4, (unsigned int) generation);
+	slotFilling = true;
+	return slot + FRAME_HEADER_SIZE;
+}
+
+
+void writeFrameRow(unsigned char* frame, unsigned int i, const unsigned int* row)
+{
+	unsigned char* out = frame + i * rowBytes;
+	if (frameFormat == FRAME_FORMAT_INDEXED)
+	{
+		for (unsigned int j=0; j<frameCols; j++)
+			out[j] = (unsigned char) row[j];
+	}
+	else
+	{
+		for (unsigned int b=0; b<rowBytes; b++)
+		{
+			unsigned char bits = 0;
+			for (unsigned int j=8*b; j<8*b+8 && j<frameCols; j++)
+				bits |= (row[j] != 0) << (7 - (j - 8*b));
+			out[b] = bits;
+		}
+	}
+}
+
+
+void closeFrameExport(void)
+{
+	if (outputPath == nullptr)
+		return;
+	exportClosing = true;
+	//	a FIFO that never got a reader still blocks the writer in open
+	if (!exportReady.load(std::memory_order_acquire))
+		pthread_cancel(writerID);
+	sem_post(&framesReady);
+	pthread_join(writerID, nullptr);
+	fprintf(stderr, "frames: %lu written, %lu dropped\n", framesWritten.load(), framesDropped.load());
+	outputPath = nullptr;
+}
+
+
+static void* frameWriterFunc(void* arg)
+{
+	(void) arg;
+
+	//	opening a FIFO blocks until there is a reader
+	if (outputFd < 0)
+	{
+		outputFd = open(outputPath, O_WRONLY);
+		if (outputFd < 0 || !setUpOutput(outputFd))
+		{
+			std::cerr << "ERROR: cannot write to " << outputPath << ": " << strerror(errno) << std::endl;
+			return nullptr;
+		}
+	}
+	int fd = outputFd;
+
+	unsigned long numWritten = 0;
+	bool ok = true;
+	while (ok)
+	{
+		sem_wait(&framesReady);
+		unsigned long numPublished = slotsPublished.load(std::memory_order_acquire);
+		if (numWritten == numPublished)
+		{
+			if (exportClosing)
+				break;
+			continue;
+		}
+		for ( ; numWritten < numPublished && ok; numWritten++)
+		{
+			ok = writeSlot(fd, slotBuffer[numWritten % numSlots]);
+			if (ok)
+				framesWritten++;
+			//	see the comment at the top of the file
+			if (numWritten + 1 >= heldBack)
+				slotsReleased.store(numWritten + 1 - heldBack, std::memory_order_release);
+		}
+	}
+
+	//	no more room in the ring once the output is gone: frames get dropped
+	if (!ok)
+		std::cerr << "ERROR: frame output " << outputPath << " closed: " << strerror(errno) << std::endl;
+	if (fd != STDOUT_FILENO)
+		close(fd);
+	outputFd = -1;
+	return nullptr;
+}
+
+//	Sizes the ring according to the output, then writes the stream header
+static bool setUpOutput(int fd)
+{
+	struct stat info;
+	useSplice = fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+	heldBack = 0;
+	if (useSplice)
+	{
+		int capacity = fcntl(fd, F_SETPIPE_SZ, (int) slotSize);
+		if (capacity < 0)
+			capacity = fcntl(fd, F_GETPIPE_SZ);
+		heldBack = capacity < 0 ? MAX_FRAME_SLOTS : (unsigned int) (capacity / slotSize) + 1;
+		//	with frames much smaller than the pipe, copying is cheaper anyway
+		if (heldBack + 2 > MAX_FRAME_SLOTS)
+		{
+			useSplice = false;
+			heldBack = 0;
+		}
+	}
+	numSlots = heldBack + 2;
+	for (unsigned int k=0; k<numSlots; k++)
+	{
+		void* buffer;
+		if (posix_memalign(&buffer, sysconf(_SC_PAGESIZE), slotSize) != 0)
+			return false;
+		slotBuffer[k] = (unsigned char*) buffer;
+	}
+
+	unsigned char header[STREAM_HEADER_SIZE];
+	memcpy(header, "CAST", 4);
+	putInt(header + 4, (unsigned int) frameFormat);
+	putInt(header + 8, frameRows);
+	putInt(header + 12, frameCols);
+	putInt(header + 16, NB_COLORS);
+	for (int c=0; c<NB_COLORS; c++)
+		for (int k=0; k<4; k++)
+			header[20 + 4*c + k] = (unsigned char) (255.f * cellColor[c][k] + 0.5f);
+	if (write(fd, header, STREAM_HEADER_SIZE) != STREAM_HEADER_SIZE)
+		return false;
+
+	exportReady.store(true, std::memory_order_release);
+	return true;
+}
+
+static bool writeSlot(int fd, unsigned char* slot)
+{
+	struct iovec iov;
+	iov.iov_base = slot;
+	iov.iov_len = slotSize;
+	while (iov.iov_len > 0)
+	{
+		ssize_t n = useSplice ? vmsplice(fd, &iov, 1, 0) : writev(fd, &iov, 1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		iov.iov_base = (char*) iov.iov_base + n;
+		iov.iov_len -= n;
+	}
+	return true;
+}
+
+static void putInt(unsigned char* dst, unsigned int value)
+{
+	for (int k=0; k<4; k++)
+		dst[k] = (unsigned char) (value >> (8*k));
+}
@@ -0,0 +1,42 @@
+//
+//  frameExport.h
+//  Cellular Automaton
+//
+//	Export of every Nth generation as raw frames, to a file or a FIFO (an
+//	external video encoder, typically).  The frames are filled by the
+//	worker threads as they compute the generation, then handed over to a
+//	writer thread; if the consumer lags and no buffer is free, the frame
+//	is dropped (and counted) rather than slowing down the simulation.
+//
+//	Stream layout (all integers are 32-bit little endian):
+//		- stream header: "CAST", format, numRows, numCols, numColors,
+//			then numColors RGBA palette entries (4 bytes each, from cellColor)
+//		- frames: "CAFR", generation, then the cells, row 0 first
+//
+
+#ifndef FRAME_EXPORT_H
+#define FRAME_EXPORT_H
+
+#define FRAME_FORMAT_INDEXED	0	//	one byte per cell: its state, i.e. its palette index
+#define FRAME_FORMAT_PACKED		1	//	one bit per cell (alive), most significant bit first,
+									//	each row padded to a whole byte
+
+//	Starts the writer thread, which opens the output (so that a FIFO without
+//	a reader yet doesn't block the simulation).  Returns false on failure.
+bool initFrameExport(const char* path, unsigned int numRows, unsigned int numCols,
+					 unsigned int every, int format);
+
+//	Both called by the last worker to finish a generation.  publishFrame
+//	hands the frame that the workers just filled (if any) to the writer;
+//	beginFrame returns the buffer the workers should fill while computing
+//	the given generation, or nullptr if that generation isn't exported.
+void publishFrame(void);
+unsigned char* beginFrame(int generation);
+
+//	Called by a worker once it has computed row i of the generation
+void writeFrameRow(unsigned char* frame, unsigned int i, const unsigned int* row);
+
+//	Waits for the pending frames to be written, and reports the counters
+void closeFrameExport(void);
+
+#endif // FRAME_EXPORT_H
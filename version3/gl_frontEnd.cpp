@@ -9,8 +9,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <math.h>
 //
+//	for the buffer object functions (glGenBuffers, glMapBuffer, ...)
+#define GL_GLEXT_PROTOTYPES
 #include "gl_frontEnd.h"
+#include "commands.h"
 
 
 //---------------------------------------------------------------------------
@@ -21,21 +27,33 @@ void myResize(int w, int h);
 void displayTextualInfo(const char* infoStr, int x, int y, int isLarge);
 void myMouse(int b, int s, int x, int y);
 void myGridPaneMouse(int b, int s, int x, int y);
+void myGridPaneMotion(int x, int y);
 void myStatePaneMouse(int b, int s, int x, int y);
 void myKeyboard(unsigned char c, int x, int y);
 void myMenuHandler(int value);
 void mySubmenuHandler(int colorIndex);
 void myTimer(int val);
+void initializeGridTextures(unsigned int numRows, unsigned int numCols);
+void setGridView(void);
+void zoomGridView(double factor, int x, int y);
+void clampGridView(void);
+void initializeFillThreads(void);
+void* fillThreadFunc(void* arg);
+void fillTexelRows(unsigned int k);
+void reduceTexelRow(GLuint* out, unsigned int** grid, unsigned int r);
+void buildGridLineTexels(GLubyte* texels);
+void drawTexturedQuad(GLuint texture, const GLfloat* texCoord);
 //
 //	implemented in main.cpp
 void cleanupAndQuit(void);
+void sampleDashboard(void);
 
 
 //---------------------------------------------------------------------------
 //  Defined in main.c --> don't touch
 //---------------------------------------------------------------------------
 
-extern const int maxNumThreads;
+extern unsigned int maxNumThreads;
 extern unsigned int rule;
 extern unsigned int colorMode;
 
@@ -70,13 +88,6 @@ const int LARGE_FONT_HEIGHT = 18;
 const int TEXT_PADDING = 0;
 const float kTextColor[4] = {1.f, 1.f, 1.f, 1.f};
 
-//	Predefine some colors for "age"-based rendering of the cells
-GLfloat cellColor[NB_COLORS][4] = {	{0.f, 0.f, 0.f, 1.f},	//	BLACK_COL
-									{1.f, 1.f, 1.f, 1.f},	//	WHITE_COL,
-									{0.f, 0.f, 1.f, 1.f},	//	BLUE_COL,
-									{0.f, 1.f, 0.f, 1.f},	//	GREEN_COL,
-									{1.f, 1.f, 0.f, 1.f},	//	YELLOW_COL,
-									{1.f, 0.f, 0.f, 1.f}};	//	RED_COL
 	
 
 //	Initial position of the window
@@ -118,53 +129,424 @@ int	gMainWindow,
 
 int drawGridLines = 0;
 
+//	The grid is rendered as a single textured quad.  The cell states are
+//	converted to RGBA texels and streamed into gridTexture through a pixel
+//	buffer object when the GL supports them (otherwise directly from client
+//	memory, which software Mesa handles fine).  The grid lines are a second,
+//	mostly transparent, texture at the resolution of the pane, blended on top.
+GLuint gridTexture = 0, gridLineTexture = 0, gridPixelBuffer = 0;
+unsigned int gridRows = 0, gridCols = 0;
+bool usePixelBuffer = false;
+GLubyte* gridTexels = NULL;
+GLuint cellTexel[NB_COLORS];	//	RGBA bytes of each color, packed in one word
+
+//	The view: the pane shows the rectangle of the grid with its lower left
+//	corner at column viewCol, row viewRow (in cells, not necessarily whole
+//	ones), and spanning numCols/viewZoom columns and numRows/viewZoom rows.
+//	The mouse wheel zooms about the cursor, dragging pans.  The texture only
+//	covers the whole cells that are (at least partly) visible, and
+//	viewTexCoord holds the texture coordinates of the corners of the view.
+double viewRow = 0., viewCol = 0., viewZoom = 1.;
+bool viewChanged = true, lineTextureStale = true;
+GLfloat viewTexCoord[4] = {0.f, 0.f, 1.f, 1.f};	//	s0, t0, s1, t1
+int dragX = -1, dragY = -1;
+double dragRow = 0., dragCol = 0.;
+const int MAX_CELL_PIXELS = 64;	//	zooming in stops at that many pixels per cell
+
+//	When the visible part of the grid has more rows (columns) than the pane
+//	has pixels, the texture is reduced to the pane's resolution: texel (r, c)
+//	summarizes the block of cells from rows texelRowStart[r] to
+//	texelRowStart[r+1]-1 and columns texelColStart[c] to texelColStart[c+1]-1,
+//	showing the block's population density (black and white mode) or its
+//	oldest cell (color mode).
+bool reducedTexture = false;
+unsigned int textureRows = 0, textureCols = 0;
+unsigned int* texelRowStart = NULL;
+unsigned int* texelColStart = NULL;
+unsigned char* texelRowDirty = NULL;
+GLuint densityTexel[256];		//	black to white ramp for the population density
+
+//	Texel rows are filled by a small pool of threads (the rendering thread
+//	included), texel row r going to thread r % numFillThreads.
+#define MAX_FILL_THREADS	8
+unsigned int numFillThreads = 0;
+pthread_t fillThreadID[MAX_FILL_THREADS];
+pthread_barrier_t fillStartBarrier, fillEndBarrier;
+GLubyte* fillTexels = NULL;
+unsigned int** fillGrid = NULL;
+
 //---------------------------------------------------------------------------
 //	Drawing functions
 //---------------------------------------------------------------------------
 
 
 //	This is the function that does the actual grid drawing
-void drawGrid(unsigned int** grid, unsigned int numRows, unsigned int numCols)
+void drawGrid(unsigned int** grid, unsigned int numRows, unsigned int numCols, unsigned char* rowDirty)
 {
-	const float	DH = (1.f * GRID_PANE_WIDTH) / numCols,
-				DV = (1.f * GRID_PANE_HEIGHT) / numRows;
-	
-	//	Display the grid as a series of quad strips
-	for (unsigned int i=0; i<numRows; i++)
+	bool uploadAll = false;
+	if (numRows != gridRows || numCols != gridCols)
 	{
-		glBegin(GL_QUAD_STRIP);
-			for (unsigned int j=0; j<numCols; j++)
-			{
-				
-				glColor4fv(cellColor[grid[i][j]]);
+		initializeGridTextures(numRows, numCols);
+		uploadAll = true;
+	}
+	if (viewChanged)
+	{
+		setGridView();
+		uploadAll = true;
+	}
 
-				glVertex2f(j*DH, i*DV);
-				glVertex2f(j*DH, (i+1)*DV);
-				glVertex2f((j+1)*DH, i*DV);
-				glVertex2f((j+1)*DH, (i+1)*DV);
-			}
-		glEnd();
+	//	A texel row must be refreshed if any of the grid rows it covers is
+	//	dirty, and then all of these rows are read
+	bool anyDirty = false;
+	for (unsigned int r=0; r<textureRows; r++)
+	{
+		bool dirty = uploadAll;
+		for (unsigned int i=texelRowStart[r]; i<texelRowStart[r+1] && !dirty; i++)
+			dirty = rowDirty[i] != 0;
+		texelRowDirty[r] = dirty;
+		anyDirty = anyDirty || dirty;
+		if (dirty)
+			memset(rowDirty + texelRowStart[r], 1, texelRowStart[r+1] - texelRowStart[r]);
 	}
 
-	if (drawGridLines)
+	//	Stream the dirty rows into the texture, one glTexSubImage2D per span
+	//	of consecutive dirty rows.  With a pixel buffer object, orphan the
+	//	previous buffer so that we never wait for the GL to be done with it,
+	//	and write the dirty rows directly at their place in the mapped buffer.
+	if (anyDirty)
 	{
-		//	Then draw a grid of lines on top of the squares
-		glColor4f(0.5f, 0.5f, 0.5f, 1.f);
-		glBegin(GL_LINES);
-			//	Horizontal
-			for (unsigned int i=0; i<= numRows; i++)
+		glBindTexture(GL_TEXTURE_2D, gridTexture);
+		GLubyte* texels = gridTexels;
+		if (usePixelBuffer)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gridPixelBuffer);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, 4*textureRows*textureCols, NULL, GL_STREAM_DRAW);
+			texels = (GLubyte*) glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		}
+		if (texels != NULL)
+		{
+			//	all the fill threads, this one included, go through the rows
+			fillTexels = texels;
+			fillGrid = grid;
+			if (numFillThreads > 1)
+				pthread_barrier_wait(&fillStartBarrier);
+			fillTexelRows(0);
+			if (numFillThreads > 1)
+				pthread_barrier_wait(&fillEndBarrier);
+
+			if (usePixelBuffer)
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+			for (unsigned int r=0; r<textureRows; )
 			{
-				glVertex2f(0, i*DV);
-				glVertex2f(GRID_PANE_WIDTH, i*DV);
+				if (!texelRowDirty[r])
+				{
+					r++;
+					continue;
+				}
+				unsigned int firstRow = r;
+				while (r<textureRows && texelRowDirty[r])
+					r++;
+				size_t offset = 4 * (size_t) firstRow * textureCols;
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, firstRow, textureCols, r - firstRow, GL_RGBA, GL_UNSIGNED_BYTE,
+								usePixelBuffer ? (const GLvoid*) offset : (const GLvoid*) (gridTexels + offset));
 			}
-			//	Vertical
-			for (unsigned int j=0; j<= numCols; j++)
+		}
+		if (usePixelBuffer)
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	drawTexturedQuad(gridTexture, viewTexCoord);
+
+	//	Lines between cells that are smaller than a pixel would hide the grid
+	if (drawGridLines && !reducedTexture)
+	{
+		if (lineTextureStale)
+		{
+			GLubyte* lineTexels = (GLubyte*) calloc(4 * GRID_PANE_WIDTH * GRID_PANE_HEIGHT, 1);
+			buildGridLineTexels(lineTexels);
+			glBindTexture(GL_TEXTURE_2D, gridLineTexture);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GRID_PANE_WIDTH, GRID_PANE_HEIGHT,
+							GL_RGBA, GL_UNSIGNED_BYTE, lineTexels);
+			free(lineTexels);
+			lineTextureStale = false;
+		}
+		const GLfloat wholeTexture[4] = {0.f, 0.f, 1.f, 1.f};
+		//	Then draw the grid of lines on top of the squares
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		drawTexturedQuad(gridLineTexture, wholeTexture);
+		glDisable(GL_BLEND);
+	}
+}
+
+//	(Re)creates the textures for a grid of the given dimensions.  Must be
+//	called with the grid pane's context current.
+void initializeGridTextures(unsigned int numRows, unsigned int numCols)
+{
+	//	Pixel buffer objects are core since OpenGL 2.1
+	int major = 0, minor = 0;
+	const char* version = (const char*) glGetString(GL_VERSION);
+	const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+	if (version != NULL)
+		sscanf(version, "%d.%d", &major, &minor);
+	usePixelBuffer = major > 2 || (major == 2 && minor >= 1) ||
+					 (extensions != NULL && strstr(extensions, "GL_ARB_pixel_buffer_object") != NULL);
+
+	//	Palette, converted once and for all to 8-bit RGBA, and the density ramp
+	GLubyte rgba[4];
+	for (int c=0; c<NB_COLORS; c++)
+	{
+		for (int k=0; k<4; k++)
+			rgba[k] = (GLubyte) (255.f * cellColor[c][k] + 0.5f);
+		memcpy(cellTexel + c, rgba, 4);
+	}
+	for (int d=0; d<256; d++)
+	{
+		for (int k=0; k<4; k++)
+			rgba[k] = (GLubyte) (255.f * ((255-d)*cellColor[BLACK_COL][k] + d*cellColor[WHITE_COL][k]) / 255.f + 0.5f);
+		memcpy(densityTexel + d, rgba, 4);
+	}
+
+	if (gridTexture == 0)
+	{
+		glGenTextures(1, &gridTexture);
+		glGenTextures(1, &gridLineTexture);
+		if (usePixelBuffer)
+			glGenBuffers(1, &gridPixelBuffer);
+		initializeFillThreads();
+	}
+	//	The grid lines texture is filled when it is first needed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, gridLineTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, GRID_PANE_WIDTH, GRID_PANE_HEIGHT, 0,
+				 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	gridRows = numRows;
+	gridCols = numCols;
+
+	//	start with the whole grid in view
+	viewRow = viewCol = 0.;
+	viewZoom = 1.;
+	viewChanged = true;
+}
+
+//	(Re)creates the grid texture for the cells in view.  Must be called with
+//	the grid pane's context current.
+void setGridView(void)
+{
+	//	whole cells (partly) in view
+	double viewRows = gridRows / viewZoom, viewCols = gridCols / viewZoom;
+	unsigned int firstRow = (unsigned int) viewRow, firstCol = (unsigned int) viewCol;
+	unsigned int endRow = (unsigned int) ceil(viewRow + viewRows);
+	unsigned int endCol = (unsigned int) ceil(viewCol + viewCols);
+	if (endRow > gridRows)
+		endRow = gridRows;
+	if (endCol > gridCols)
+		endCol = gridCols;
+	unsigned int numRows = endRow - firstRow, numCols = endCol - firstCol;
+
+	//	At most one texel per pixel of the pane (plus one for the partly
+	//	visible cells at the edges)
+	textureRows = numRows <= (unsigned int) GRID_PANE_HEIGHT + 1 ? numRows : GRID_PANE_HEIGHT;
+	textureCols = numCols <= (unsigned int) GRID_PANE_WIDTH + 1 ? numCols : GRID_PANE_WIDTH;
+	reducedTexture = textureRows < numRows || textureCols < numCols;
+	free(texelRowStart);
+	free(texelColStart);
+	free(texelRowDirty);
+	texelRowStart = (unsigned int*) malloc((textureRows + 1) * sizeof(unsigned int));
+	texelColStart = (unsigned int*) malloc((textureCols + 1) * sizeof(unsigned int));
+	texelRowDirty = (unsigned char*) malloc(textureRows);
+	for (unsigned int r=0; r<=textureRows; r++)
+		texelRowStart[r] = firstRow + (unsigned int) (((unsigned long) r * numRows) / textureRows);
+	for (unsigned int c=0; c<=textureCols; c++)
+		texelColStart[c] = firstCol + (unsigned int) (((unsigned long) c * numCols) / textureCols);
+
+	viewTexCoord[0] = (GLfloat) ((viewCol - firstCol) / numCols);
+	viewTexCoord[1] = (GLfloat) ((viewRow - firstRow) / numRows);
+	viewTexCoord[2] = (GLfloat) ((viewCol + viewCols - firstCol) / numCols);
+	viewTexCoord[3] = (GLfloat) ((viewRow + viewRows - firstRow) / numRows);
+
+	free(gridTexels);
+	gridTexels = (GLubyte*) malloc(4 * (size_t) textureRows * textureCols);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, gridTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, textureCols, textureRows, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	viewChanged = false;
+	lineTextureStale = true;
+}
+
+//	Zooms the view by the given factor, keeping the cell under the pixel
+//	(x, y) of the grid pane (glut coordinates, y pointing down) in place
+void zoomGridView(double factor, int x, int y)
+{
+	if (gridRows == 0)
+		return;
+	double maxZoom = fmin(gridCols / (1. * GRID_PANE_WIDTH / MAX_CELL_PIXELS),
+						  gridRows / (1. * GRID_PANE_HEIGHT / MAX_CELL_PIXELS));
+	double zoom = fmax(1., fmin(viewZoom * factor, fmax(1., maxZoom)));
+
+	double u = (double) x / GRID_PANE_WIDTH, v = (double) (GRID_PANE_HEIGHT - y) / GRID_PANE_HEIGHT;
+	double col = viewCol + u * gridCols / viewZoom, row = viewRow + v * gridRows / viewZoom;
+	viewZoom = zoom;
+	viewCol = col - u * gridCols / viewZoom;
+	viewRow = row - v * gridRows / viewZoom;
+	clampGridView();
+	viewChanged = true;
+}
+
+//	Keeps the view within the grid
+void clampGridView(void)
+{
+	double viewRows = gridRows / viewZoom, viewCols = gridCols / viewZoom;
+	viewRow = fmax(0., fmin(viewRow, gridRows - viewRows));
+	viewCol = fmax(0., fmin(viewCol, gridCols - viewCols));
+}
+
+//	One fill thread per core, up to MAX_FILL_THREADS
+void initializeFillThreads(void)
+{
+	long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+	numFillThreads = numCores < 1 ? 1 : (numCores > MAX_FILL_THREADS ? MAX_FILL_THREADS : (unsigned int) numCores);
+	if (numFillThreads == 1)
+		return;
+
+	pthread_barrier_init(&fillStartBarrier, NULL, numFillThreads);
+	pthread_barrier_init(&fillEndBarrier, NULL, numFillThreads);
+	for (unsigned int k=1; k<numFillThreads; k++)
+	{
+		if (pthread_create(fillThreadID + k, NULL, fillThreadFunc, (void*) (unsigned long) k) != 0)
+		{
+			fprintf(stderr, "ERROR: Failed to create texture fill thread\n");
+			exit(1);
+		}
+	}
+}
+
+void* fillThreadFunc(void* arg)
+{
+	unsigned int k = (unsigned int) (unsigned long) arg;
+	while (true)
+	{
+		pthread_barrier_wait(&fillStartBarrier);
+		fillTexelRows(k);
+		pthread_barrier_wait(&fillEndBarrier);
+	}
+	return NULL;
+}
+
+//	Fills the dirty texel rows assigned to fill thread k
+void fillTexelRows(unsigned int k)
+{
+	for (unsigned int r=k; r<textureRows; r+=numFillThreads)
+	{
+		if (!texelRowDirty[r])
+			continue;
+
+		GLuint* out = (GLuint*) fillTexels + (size_t) r * textureCols;
+		if (reducedTexture)
+			reduceTexelRow(out, fillGrid, r);
+		else
+		{
+			const unsigned int* row = fillGrid[texelRowStart[r]] + texelColStart[0];
+			for (unsigned int j=0; j<textureCols; j++)
+				out[j] = cellTexel[row[j]];
+		}
+	}
+}
+
+//	Summarizes the blocks of cells covered by texel row r
+void reduceTexelRow(GLuint* out, unsigned int** grid, unsigned int r)
+{
+	unsigned int population[GRID_PANE_WIDTH + 1], oldest[GRID_PANE_WIDTH + 1];
+	memset(population, 0, textureCols * sizeof(unsigned int));
+	memset(oldest, 0, textureCols * sizeof(unsigned int));
+
+	for (unsigned int i=texelRowStart[r]; i<texelRowStart[r+1]; i++)
+	{
+		const unsigned int* row = grid[i];
+		for (unsigned int c=0; c<textureCols; c++)
+		{
+			unsigned int count = 0, age = oldest[c];
+			for (unsigned int j=texelColStart[c]; j<texelColStart[c+1]; j++)
 			{
-				glVertex2f(j*DH, 0);
-				glVertex2f(j*DH, GRID_PANE_HEIGHT);
+				count += row[j] != 0;
+				if (row[j] > age)
+					age = row[j];
 			}
-		glEnd();
+			population[c] += count;
+			oldest[c] = age;
+		}
 	}
+
+	unsigned int blockRows = texelRowStart[r+1] - texelRowStart[r];
+	for (unsigned int c=0; c<textureCols; c++)
+	{
+		if (colorMode)
+			out[c] = cellTexel[oldest[c]];
+		else
+		{
+			unsigned int blockSize = blockRows * (texelColStart[c+1] - texelColStart[c]);
+			out[c] = densityTexel[(255 * population[c]) / blockSize];
+		}
+	}
+}
+
+//	Gray opaque texels wherever a grid line of the view falls, transparent
+//	elsewhere
+void buildGridLineTexels(GLubyte* texels)
+{
+	const double	DH = (viewZoom * GRID_PANE_WIDTH) / gridCols,
+					DV = (viewZoom * GRID_PANE_HEIGHT) / gridRows;
+	const GLubyte gray[4] = {128, 128, 128, 255};
+
+	//	Horizontal
+	for (unsigned int i=texelRowStart[0]; i<=texelRowStart[textureRows]; i++)
+	{
+		int y = (int) ((i - viewRow)*DV);
+		if (y < 0 || y > GRID_PANE_HEIGHT)
+			continue;
+		if (y == GRID_PANE_HEIGHT)
+			y = GRID_PANE_HEIGHT - 1;
+		for (int x=0; x<GRID_PANE_WIDTH; x++)
+			memcpy(texels + 4*(y*GRID_PANE_WIDTH + x), gray, 4);
+	}
+	//	Vertical
+	for (unsigned int j=texelColStart[0]; j<=texelColStart[textureCols]; j++)
+	{
+		int x = (int) ((j - viewCol)*DH);
+		if (x < 0 || x > GRID_PANE_WIDTH)
+			continue;
+		if (x == GRID_PANE_WIDTH)
+			x = GRID_PANE_WIDTH - 1;
+		for (int y=0; y<GRID_PANE_HEIGHT; y++)
+			memcpy(texels + 4*(y*GRID_PANE_WIDTH + x), gray, 4);
+	}
+}
+
+//	Maps the rectangle (s0, t0)-(s1, t1) of the texture onto the whole grid pane
+void drawTexturedQuad(GLuint texture, const GLfloat* texCoord)
+{
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	glColor4f(1.f, 1.f, 1.f, 1.f);
+	glBegin(GL_QUADS);
+		glTexCoord2f(texCoord[0], texCoord[1]);	glVertex2f(0.f, 0.f);
+		glTexCoord2f(texCoord[2], texCoord[1]);	glVertex2f(GRID_PANE_WIDTH, 0.f);
+		glTexCoord2f(texCoord[2], texCoord[3]);	glVertex2f(GRID_PANE_WIDTH, GRID_PANE_HEIGHT);
+		glTexCoord2f(texCoord[0], texCoord[3]);	glVertex2f(0.f, GRID_PANE_HEIGHT);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
 }
 
 
@@ -239,16 +621,23 @@ void displayTextualInfo(const char* infoStr, int xPos, int yPos, int isLarge)
 
 
 
-void drawState(unsigned int numLiveThreads)
+void drawState(unsigned int numLiveThreads, const char* const* infoLines, unsigned int numInfoLines)
 {
 	const int H_PAD = STATE_PANE_WIDTH / 16;
 	const int TOP_LEVEL_TXT_Y = 4*STATE_PANE_HEIGHT / 5;
+	const int LINE_SPACING = SMALL_FONT_HEIGHT + 4;
 
 	//	Build, then display text info for the red, green, and blue tanks
 	char infoStr[256];
 	//	display info about number of live threads
 	sprintf(infoStr, "Live Threads: %d", numLiveThreads);
 	displayTextualInfo(infoStr, H_PAD, TOP_LEVEL_TXT_Y, 1);
+
+	//	then the additional lines provided by the application, in small font,
+	//	for as many as fit in the pane
+	int y = TOP_LEVEL_TXT_Y - LARGE_FONT_HEIGHT - LINE_SPACING;
+	for (unsigned int k=0; k<numInfoLines && y>0; k++, y-=LINE_SPACING)
+		displayTextualInfo(infoLines[k], H_PAD, y, 0);
 }
 
 
@@ -298,26 +687,37 @@ void myMouse(int button, int state, int x, int y)
 	glutPostRedisplay();
 }
 
-//	This function is called when a mouse event occurs in the grid pane
+//	This function is called when a mouse event occurs in the grid pane:
+//	the wheel zooms about the cursor, dragging with the left button pans
 //
 void myGridPaneMouse(int button, int state, int x, int y)
 {
-	(void) state;
-	(void) x;
-	(void) y;
-	
 	switch (button)
 	{
 		case GLUT_LEFT_BUTTON:
 			if (state == GLUT_DOWN)
 			{
-				//	do something
+				dragX = x;
+				dragY = y;
+				dragRow = viewRow;
+				dragCol = viewCol;
 			}
 			else if (state == GLUT_UP)
 			{
-				//	exit(0);
+				dragX = dragY = -1;
 			}
 			break;
+
+		//	glut reports the wheel as buttons 3 (up) and 4 (down)
+		case 3:
+			if (state == GLUT_DOWN)
+				zoomGridView(1.25, x, y);
+			break;
+
+		case 4:
+			if (state == GLUT_DOWN)
+				zoomGridView(0.8, x, y);
+			break;
 			
 		default:
 			break;
@@ -327,6 +727,20 @@ void myGridPaneMouse(int button, int state, int x, int y)
 	glutPostRedisplay();
 }
 
+//	Mouse motion with a button down in the grid pane
+void myGridPaneMotion(int x, int y)
+{
+	if (dragX < 0 || gridRows == 0)
+		return;
+	viewCol = dragCol - (x - dragX) * (gridCols / viewZoom) / GRID_PANE_WIDTH;
+	viewRow = dragRow + (y - dragY) * (gridRows / viewZoom) / GRID_PANE_HEIGHT;
+	clampGridView();
+	viewChanged = true;
+
+	glutSetWindow(gMainWindow);
+	glutPostRedisplay();
+}
+
 
 //	This callback function is called when a keyboard event occurs
 //
@@ -346,52 +760,67 @@ void myKeyboard(unsigned char c, int x, int y)
 
 		//	spacebar --> resets the grid
 		case ' ':
-			resetGrid();
+			postCommand(COMMAND_RESET, 0);
 			break;
 
 		//	'+' --> increase simulation speed
 		case '+':
-			speed *= 9;
-			speed /= 10;
+			postCommand(COMMAND_FASTER, 0);
 			break;
 
 		//	'-' --> reduce simulation speed
 		case '-':
-			speed *= 11;
-			speed /= 10;
+			postCommand(COMMAND_SLOWER, 0);
+			break;
+
+		//	'>' --> add one worker thread
+		case '>':
+			postCommand(COMMAND_ADD_THREADS, 1);
+			break;
+
+		//	'<' --> remove one worker thread
+		case '<':
+			postCommand(COMMAND_ADD_THREADS, -1);
 			break;
 
 		//	'1' --> apply Rule 1 (Game of Life: B23/S3)
 		case '1':
-			rule = GAME_OF_LIFE_RULE;
+			postCommand(COMMAND_RULE, GAME_OF_LIFE_RULE);
 			break;
 
 		//	'2' --> apply Rule 2 (Coral: B3_S45678)
 		case '2':
-			rule = CORAL_GROWTH_RULE;
+			postCommand(COMMAND_RULE, CORAL_GROWTH_RULE);
 			break;
 
-		//	'3' --> apply Rule 3 (Amoeba: B357/S1358)
+		//	'3' --> apply Rule 3 (Amoeba: B1358/S1358)
 		case '3':
-			rule = AMOEBA_RULE;
+			postCommand(COMMAND_RULE, AMOEBA_RULE);
 			break;
 
 		//	'4' --> apply Rule 4 (Maze: B3/S12345)
 		case '4':
-			rule = MAZE_RULE;
+			postCommand(COMMAND_RULE, MAZE_RULE);
 			break;
 
 		//	'c' --> toggles on/off color mode
 		//	'b' --> toggles off/on color mode
 		case 'c':
 		case 'b':
-			colorMode = !colorMode;
+			postCommand(COMMAND_COLOR, -1);
 			break;
 
 		//	'l' --> toggles on/off grid line rendering
 		case 'l':
 			drawGridLines = !drawGridLines;
 			break;
+
+		//	'z' --> zoom back out to the whole grid
+		case 'z':
+			viewRow = viewCol = 0.;
+			viewZoom = 1.;
+			viewChanged = true;
+			break;
 		default:
 			ok = false;
 			break;
@@ -445,6 +874,7 @@ void myTimer(int value)
 
 	//  possibly I do something to update the state information displayed
     //	in the "state" pane
+	sampleDashboard();
 	
 	////	This call must **DEFINITELY** go away.  After you have properly multithreaded
 	////	the code, the processing threads will run without having to be called within
@@ -514,6 +944,7 @@ void initializeFrontEnd(int argc, char** argv, void (*gridDisplayCB)(void),
 	glClearColor(0.f, 0.f, 0.f, 1.f);
 	glutKeyboardFunc(myKeyboard);
 	glutMouseFunc(myGridPaneMouse);
+	glutMotionFunc(myGridPaneMotion);
 	glutDisplayFunc(gridDisplayCB);
 	
 	
@@ -527,6 +958,6 @@ void initializeFrontEnd(int argc, char** argv, void (*gridDisplayCB)(void),
 	glOrtho(0.0f, STATE_PANE_WIDTH, 0.0f, STATE_PANE_HEIGHT, -1, 1);
 	glClearColor(0.f, 0.f, 0.f, 1.f);
 	glutKeyboardFunc(myKeyboard);
-	glutMouseFunc(myGridPaneMouse);
+	glutMouseFunc(myStatePaneMouse);
 	glutDisplayFunc(stateDisplayCB);
 }
@@ -9,6 +9,11 @@
 #define GL_FRONT_END_H
 
 
+//------------------------------------------------------------------------------
+//	A headless build (HEADLESS defined) only uses the data types and
+//	the functions implemented in main.cpp, and doesn't need GL or glut.
+//------------------------------------------------------------------------------
+#ifndef HEADLESS
 //------------------------------------------------------------------------------
 //	Find out whether we are on Linux or macOS (sorry, Windows people)
 //	and load the OpenGL & glut headers.
@@ -29,6 +34,7 @@
 #else
 	#error unknown OS
 #endif
+#endif // HEADLESS
 
 
 //-----------------------------------------------------------------------------
@@ -47,6 +53,9 @@ typedef enum ColorLabel {
 	NB_COLORS
 } ColorLabel;
 
+//	RGBA color of each cell state, defined in main.cpp
+extern float cellColor[NB_COLORS][4];
+
 //	Rules of the automaton (in C, it's a lot more complicated than in
 //	C++/Java/Python/Swift to define an easy-to-initialize data type storing
 //	arrays of numbers.  So, in this program I hard-code my rules
@@ -59,8 +68,11 @@ typedef enum ColorLabel {
 //	Function prototypes
 //-----------------------------------------------------------------------------
 
-void drawGrid(unsigned int**grid, unsigned int numRows, unsigned int numCols);
-void drawState(unsigned int numLiveThreads);
+//	Only the rows flagged in rowDirty are re-uploaded (all of them when the
+//	textures have just been created).  On return, rowDirty flags every row
+//	that was read from grid, which can be more than those asked for.
+void drawGrid(unsigned int**grid, unsigned int numRows, unsigned int numCols, unsigned char* rowDirty);
+void drawState(unsigned int numLiveThreads, const char* const* infoLines, unsigned int numInfoLines);
 void initializeFrontEnd(int argc, char** argv, void (*gridCB)(void), void (*stateCB)(void));
 
 //	Functions implemented in main.c but called byt the glut callback functions
@@ -0,0 +1,225 @@
+//
+//  gridStore.cpp
+//  Cellular Automaton
+//
+//	Rows are not page aligned, so the ranges given to the kernel are
+//	rounded inward to whole pages: a page shared with the next window (or
+//	with the band of another worker) is left for whoever finishes it.
+//	Dropping a page that another thread is still using would only cost a
+//	page fault anyway: the data is in the file, and the kernel never
+//	discards dirty pages of a shared mapping.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+//
+#include "gridStore.h"
+
+#define GRID_WINDOW_BYTES	(8UL << 20)	//	rows per window, in bytes of one grid
+
+using GridFile = struct {
+	int fd;
+	char* base;
+	size_t size;
+};
+
+static GridFile gridFile[2] = {{-1, nullptr, 0}, {-1, nullptr, 0}};
+static unsigned int storeFirstRow = 0;
+static size_t storeRowBytes = 0;
+static size_t pageSize = 4096;
+static unsigned int windowRows = 0;
+
+static bool createGridFile(GridFile* file, const char* dir, size_t size);
+static GridFile* fileOf(unsigned int** grid);
+static bool pageRange(unsigned int firstRow, unsigned int lastRow, size_t* offset, size_t* length);
+static void startWriteback(unsigned int** grid, unsigned int firstRow, unsigned int lastRow);
+static void dropRows(unsigned int** grid, unsigned int firstRow, unsigned int lastRow, bool written);
+
+
+bool openGridStore(const char* dir, unsigned int firstRow, unsigned int lastRow,
+				   unsigned int numCols, unsigned int** gridA, unsigned int** gridB)
+{
+	pageSize = (size_t) sysconf(_SC_PAGESIZE);
+	storeFirstRow = firstRow;
+	storeRowBytes = (size_t) numCols * sizeof(unsigned int);
+	windowRows = GRID_WINDOW_BYTES / storeRowBytes;
+	if (windowRows == 0)
+		windowRows = 1;
+
+	size_t size = storeRowBytes * (lastRow - firstRow + 1);
+	unsigned int** grids[2] = {gridA, gridB};
+	for (int g=0; g<2; g++)
+	{
+		if (!createGridFile(gridFile + g, dir, size))
+		{
+			closeGridStore();
+			return false;
+		}
+		for (unsigned int i=firstRow; i<=lastRow; i++)
+			grids[g][i] = reinterpret_cast<unsigned int*>(gridFile[g].base + (i - firstRow) * storeRowBytes);
+	}
+	return true;
+}
+
+
+bool gridStoreActive(void)
+{
+	return gridFile[0].base != nullptr;
+}
+
+
+void beginGridWindow(GridWindow* window, unsigned int firstRow)
+{
+	window->firstRow = firstRow;
+	window->pendingRow = firstRow;
+	window->pending = false;
+}
+
+
+void advanceGridWindow(GridWindow* window, unsigned int** readGrid, unsigned int** writeGrid,
+					   unsigned int row, bool lastRowOfBand)
+{
+	if (!lastRowOfBand && row + 1 - window->firstRow < windowRows)
+		return;
+
+	//	The window just computed goes to the disk in the background...
+	startWriteback(writeGrid, window->firstRow, row);
+
+	//	...while the one before it should be there by now.  Waiting for it is
+	//	what keeps a worker from running ahead of the disk.
+	if (window->pending)
+	{
+		dropRows(writeGrid, window->pendingRow, window->firstRow - 1, true);
+		dropRows(readGrid, window->pendingRow, window->firstRow - 1, false);
+	}
+	if (lastRowOfBand)
+	{
+		dropRows(writeGrid, window->firstRow, row, true);
+		dropRows(readGrid, window->firstRow, row, false);
+		window->pending = false;
+	}
+	else
+	{
+		window->pendingRow = window->firstRow;
+		window->pending = true;
+	}
+	window->firstRow = row + 1;
+}
+
+
+void flushGridRows(unsigned int** grid, unsigned int firstRow, unsigned int lastRow)
+{
+	if (!gridStoreActive())
+		return;
+	for (unsigned int i=firstRow; i<=lastRow; i+=windowRows)
+	{
+		unsigned int last = lastRow - i < windowRows ? lastRow : i + windowRows - 1;
+		startWriteback(grid, i, last);
+		dropRows(grid, i, last, true);
+	}
+}
+
+
+void closeGridStore(void)
+{
+	for (int g=0; g<2; g++)
+	{
+		if (gridFile[g].base != nullptr)
+			munmap(gridFile[g].base, gridFile[g].size);
+		if (gridFile[g].fd >= 0)
+			close(gridFile[g].fd);
+		gridFile[g].base = nullptr;
+		gridFile[g].fd = -1;
+	}
+}
+
+
+//	The file is unlinked right away: its blocks are freed when the process
+//	exits, however it exits
+static bool createGridFile(GridFile* file, const char* dir, size_t size)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/cell_grid_XXXXXX", dir);
+	file->fd = mkstemp(path);
+	if (file->fd < 0)
+	{
+		std::cerr << "ERROR: cannot create a grid file in " << dir << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	unlink(path);
+
+	//	Reserve the blocks now: running out of space halfway through a
+	//	generation would kill the process with a SIGBUS
+	int err = posix_fallocate(file->fd, 0, size);
+	if (err == EOPNOTSUPP || err == EINVAL)
+		err = ftruncate(file->fd, size) < 0 ? errno : 0;
+	if (err != 0)
+	{
+		std::cerr << "ERROR: cannot allocate " << size << " bytes in " << dir << ": " << strerror(err) << std::endl;
+		return false;
+	}
+
+	void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+	if (mem == MAP_FAILED)
+	{
+		std::cerr << "ERROR: cannot map a grid file: " << strerror(errno) << std::endl;
+		return false;
+	}
+	file->base = static_cast<char*>(mem);
+	file->size = size;
+	//	every generation reads and writes the grids from top to bottom
+	madvise(file->base, size, MADV_SEQUENTIAL);
+	posix_fadvise(file->fd, 0, size, POSIX_FADV_SEQUENTIAL);
+	return true;
+}
+
+static GridFile* fileOf(unsigned int** grid)
+{
+	char* row = reinterpret_cast<char*>(grid[storeFirstRow]);
+	for (int g=0; g<2; g++)
+		if (row == gridFile[g].base)
+			return gridFile + g;
+	return nullptr;
+}
+
+//	The whole pages that lie within rows firstRow to lastRow
+static bool pageRange(unsigned int firstRow, unsigned int lastRow, size_t* offset, size_t* length)
+{
+	size_t start = (firstRow - storeFirstRow) * storeRowBytes;
+	size_t end = (lastRow + 1 - storeFirstRow) * storeRowBytes;
+	start = (start + pageSize - 1) / pageSize * pageSize;
+	end = end / pageSize * pageSize;
+	if (end <= start)
+		return false;
+	*offset = start;
+	*length = end - start;
+	return true;
+}
+
+static void startWriteback(unsigned int** grid, unsigned int firstRow, unsigned int lastRow)
+{
+	GridFile* file = fileOf(grid);
+	size_t offset, length;
+	if (file != nullptr && pageRange(firstRow, lastRow, &offset, &length))
+		sync_file_range(file->fd, offset, length, SYNC_FILE_RANGE_WRITE);
+}
+
+//	Written rows are waited for first: only clean pages leave the page cache
+static void dropRows(unsigned int** grid, unsigned int firstRow, unsigned int lastRow, bool written)
+{
+	GridFile* file = fileOf(grid);
+	size_t offset, length;
+	if (file == nullptr || !pageRange(firstRow, lastRow, &offset, &length))
+		return;
+	if (written)
+		sync_file_range(file->fd, offset, length,
+						SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	madvise(file->base + offset, length, MADV_DONTNEED);
+	posix_fadvise(file->fd, offset, length, POSIX_FADV_DONTNEED);
+}
@@ -0,0 +1,55 @@
+//
+//  gridStore.h
+//  Cellular Automaton
+//
+//	Out-of-core storage of the two grids, for grids that don't fit in
+//	memory.  Each grid lives in a scratch file of its own (removed as soon
+//	as it is created, so nothing is left behind) that is mapped in shared
+//	mode: the row pointers point straight into the mappings, and the rest
+//	of the code doesn't know the difference.
+//
+//	Left alone, the kernel would keep as much of the files cached as it can
+//	and write back dirty rows whenever it sees fit.  Instead, the workers
+//	stream through their band one window of rows at a time: a window is
+//	queued for writeback as soon as it is computed, and once the following
+//	window is done it is waited for and dropped from memory, along with the
+//	rows of the current generation it was computed from.  Each worker thus
+//	keeps about two windows of each grid in memory, and the simulation runs
+//	at whatever pace the disk allows.
+//
+
+#ifndef GRID_STORE_H
+#define GRID_STORE_H
+
+//	Position of a worker within its band
+typedef struct GridWindow {
+	unsigned int firstRow;		//	first row of the window being computed
+	unsigned int pendingRow;	//	first row of the window being written back
+	bool pending;
+} GridWindow;
+
+//	Creates the two files in directory dir, sized for rows firstRow to
+//	lastRow of a grid of numCols columns, and sets the row pointers of
+//	gridA and gridB (the other rows are set to nullptr).  Returns false on
+//	failure.
+bool openGridStore(const char* dir, unsigned int firstRow, unsigned int lastRow,
+				   unsigned int numCols, unsigned int** gridA, unsigned int** gridB);
+
+//	True when the grids are stored in files
+bool gridStoreActive(void);
+
+//	To be called before the first row of a band
+void beginGridWindow(GridWindow* window, unsigned int firstRow);
+
+//	To be called after each row of a band has been computed from readGrid
+//	into writeGrid.  Does nothing until a window has been completed.
+void advanceGridWindow(GridWindow* window, unsigned int** readGrid, unsigned int** writeGrid,
+					   unsigned int row, bool lastRowOfBand);
+
+//	Same treatment for rows that were rewritten outside of a generation
+//	(reset, checkpoint, pattern): writes them back and drops them.
+void flushGridRows(unsigned int** grid, unsigned int firstRow, unsigned int lastRow);
+
+void closeGridStore(void);
+
+#endif // GRID_STORE_H
@@ -0,0 +1,419 @@
+//
+//  halo.cpp
+//  Cellular Automaton
+//
+//	Two transports are implemented:
+//		- shared memory: one ring buffer of HALO_RING_SLOTS rows per
+//			directed link, in a segment named /cell_<session>_<from>_<to>.
+//			The producer publishes a row by bumping a counter, the consumer
+//			acknowledges it the same way, so no lock is ever taken.
+//		- sockets: one Unix-domain stream socket per pair of neighbors.
+//			Process k+1 listens on /tmp/cell_<session>_<k+1>.sock and
+//			process k connects to it.
+//
+//	A neighbor is lost when its socket is closed, when its process is gone
+//	(each end of a ring records its pid), or when it hasn't moved for
+//	HALO_TIMEOUT seconds.
+//
+//	A segment outlives a run that was killed before closeHaloExchange, with
+//	its counters as they were.  The pid of our own end tells it apart from
+//	one just created by the neighbor: such a leftover is refused, rather
+//	than read as a ring with stale rows in it.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+//
+#include "halo.h"
+
+#define HALO_RING_SLOTS	4
+#define HALO_TIMEOUT	60.	//	seconds without any progress from a neighbor
+
+//	Header of a shared memory segment, followed by the ring of rows
+using HaloRing = struct {
+	std::atomic<unsigned long> published;	//	number of rows written by the producer
+	std::atomic<unsigned long> consumed;	//	number of rows read by the consumer
+	std::atomic<int> producerPid;			//	0 until that end has opened the segment
+	std::atomic<int> consumerPid;
+};
+
+using HaloLink = struct {
+	bool active;
+	bool sending;
+	//	shared memory transport
+	char name[128];
+	HaloRing* ring;
+	unsigned int* slots;
+	size_t size;
+	unsigned long count;
+	//	socket transport (one socket serves both directions)
+	int fd;
+};
+
+//	index 0 is the link with the slab above, index 1 with the slab below
+static HaloLink sendLink[2], recvLink[2];
+static int haloTransport = HALO_TRANSPORT_SHM;
+static unsigned int haloNumCols = 0;
+static int listenFd = -1;
+static char listenPath[108];
+
+static bool openRing(HaloLink* link, const char* session, unsigned int from, unsigned int to, bool sending);
+static bool waitABit(HaloLink* link, unsigned int& spins, double& waitStart);
+static bool peerAlive(HaloLink* link);
+static double haloClock(void);
+static bool openSockets(const char* session, unsigned int slab, unsigned int numSlabs);
+static bool transferRows(unsigned int** grid, unsigned int firstRow, unsigned int lastRow);
+
+
+bool initHaloExchange(const char* session, unsigned int slab, unsigned int numSlabs,
+					  unsigned int numCols, int transport)
+{
+	haloTransport = transport;
+	haloNumCols = numCols;
+	memset(sendLink, 0, sizeof(sendLink));
+	memset(recvLink, 0, sizeof(recvLink));
+	for (int d=0; d<2; d++)
+		sendLink[d].fd = recvLink[d].fd = -1;
+
+	sendLink[0].active = recvLink[0].active = slab > 0;
+	sendLink[1].active = recvLink[1].active = slab + 1 < numSlabs;
+
+	if (transport == HALO_TRANSPORT_SOCKET)
+		return openSockets(session, slab, numSlabs);
+
+	//	Both ends create the segment and set its size, so it doesn't
+	//	matter which one of the two processes gets there first.
+	bool ok = true;
+	if (slab > 0)
+	{
+		ok = ok && openRing(sendLink + 0, session, slab, slab-1, true);
+		ok = ok && openRing(recvLink + 0, session, slab-1, slab, false);
+	}
+	if (slab + 1 < numSlabs)
+	{
+		ok = ok && openRing(sendLink + 1, session, slab, slab+1, true);
+		ok = ok && openRing(recvLink + 1, session, slab+1, slab, false);
+	}
+	return ok;
+}
+
+
+bool exchangeHalos(unsigned int** grid, unsigned int firstRow, unsigned int lastRow)
+{
+	if (haloTransport == HALO_TRANSPORT_SOCKET)
+		return transferRows(grid, firstRow, lastRow);
+
+	const size_t rowSize = haloNumCols * sizeof(unsigned int);
+	unsigned int* sendRow[2] = {grid[firstRow], grid[lastRow]};
+
+	//	Publish our edge rows first, so that the neighbors can proceed
+	for (int d=0; d<2; d++)
+	{
+		HaloLink* link = sendLink + d;
+		if (!link->active)
+			continue;
+		//	wait for a free slot (the consumer is never more than a
+		//	few generations behind, since it needs our rows to advance)
+		unsigned int spins = 0;
+		double waitStart = 0.;
+		while (link->count - link->ring->consumed.load(std::memory_order_acquire) >= HALO_RING_SLOTS)
+			if (!waitABit(link, spins, waitStart))
+				return false;
+		memcpy(link->slots + (link->count % HALO_RING_SLOTS) * haloNumCols, sendRow[d], rowSize);
+		link->count++;
+		link->ring->published.store(link->count, std::memory_order_release);
+	}
+
+	//	then collect the halos
+	for (int d=0; d<2; d++)
+	{
+		HaloLink* link = recvLink + d;
+		if (!link->active)
+			continue;
+		unsigned int* haloRow = d == 0 ? grid[firstRow-1] : grid[lastRow+1];
+		unsigned int spins = 0;
+		double waitStart = 0.;
+		while (link->ring->published.load(std::memory_order_acquire) <= link->count)
+			if (!waitABit(link, spins, waitStart))
+				return false;
+		memcpy(haloRow, link->slots + (link->count % HALO_RING_SLOTS) * haloNumCols, rowSize);
+		link->count++;
+		link->ring->consumed.store(link->count, std::memory_order_release);
+	}
+	return true;
+}
+
+
+void closeHaloExchange(void)
+{
+	for (int d=0; d<2; d++)
+	{
+		HaloLink* links[2] = {sendLink + d, recvLink + d};
+		for (HaloLink* link : links)
+		{
+			if (link->ring != nullptr)
+				munmap(link->ring, link->size);
+			link->ring = nullptr;
+		}
+		//	both ends remove the segments (the names only: the mappings stay
+		//	valid), so that none is left behind by a neighbor that died
+		if (sendLink[d].active && haloTransport == HALO_TRANSPORT_SHM)
+		{
+			shm_unlink(sendLink[d].name);
+			shm_unlink(recvLink[d].name);
+		}
+		if (sendLink[d].fd >= 0)
+			close(sendLink[d].fd);
+		sendLink[d].fd = recvLink[d].fd = -1;
+		sendLink[d].active = recvLink[d].active = false;
+	}
+	if (listenFd >= 0)
+	{
+		close(listenFd);
+		unlink(listenPath);
+		listenFd = -1;
+	}
+}
+
+
+//---------------------------------------------------------------------------
+//	Shared memory transport
+//---------------------------------------------------------------------------
+
+static bool openRing(HaloLink* link, const char* session, unsigned int from, unsigned int to, bool sending)
+{
+	snprintf(link->name, sizeof(link->name), "/cell_%s_%u_%u", session, from, to);
+	link->size = sizeof(HaloRing) + HALO_RING_SLOTS * haloNumCols * sizeof(unsigned int);
+
+	int fd = shm_open(link->name, O_CREAT | O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, link->size) < 0)
+	{
+		std::cerr << "ERROR: cannot create halo segment " << link->name << ": " << strerror(errno) << std::endl;
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	void* mem = mmap(nullptr, link->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+	{
+		std::cerr << "ERROR: cannot map halo segment " << link->name << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+	//	A new segment is all zeros, which is a valid empty ring.  One that
+	//	already has a pid at our end, or a dead process at the other, was
+	//	left behind by an earlier run of the same session.
+	link->ring = static_cast<HaloRing*>(mem);
+	link->slots = reinterpret_cast<unsigned int*>(link->ring + 1);
+	link->count = 0;
+	link->sending = sending;
+	int ownPid = 0;
+	if (!(sending ? link->ring->producerPid : link->ring->consumerPid).compare_exchange_strong(ownPid, (int) getpid()) ||
+		!peerAlive(link))
+	{
+		std::cerr << "ERROR: halo segment " << link->name << " is left over from an earlier run of session "
+				  << session << ", use another --session" << std::endl;
+		munmap(mem, link->size);
+		link->ring = nullptr;
+		return false;
+	}
+	return true;
+}
+
+//	Spin for a while, then start yielding the CPU to the other processes.
+//	Once in a while (every 2000 naps, about 0.1 s), makes sure that the
+//	neighbor is still there.  Returns false if it isn't.
+static bool waitABit(HaloLink* link, unsigned int& spins, double& waitStart)
+{
+	if (++spins < 1000)
+	{
+		sched_yield();
+		return true;
+	}
+	usleep(50);
+	if (spins % 2000 != 0)
+		return true;
+
+	if (waitStart == 0.)
+		waitStart = haloClock();
+	if (!peerAlive(link))
+	{
+		std::cerr << "ERROR: the neighboring slab's process is gone (" << link->name << ")" << std::endl;
+		return false;
+	}
+	if (haloClock() - waitStart > HALO_TIMEOUT)
+	{
+		std::cerr << "ERROR: no halo exchange with the neighboring slab for " << HALO_TIMEOUT
+				  << " s (" << link->name << ")" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//	A neighbor that hasn't opened the segment yet counts as alive
+static bool peerAlive(HaloLink* link)
+{
+	int pid = (link->sending ? link->ring->consumerPid : link->ring->producerPid).load(std::memory_order_acquire);
+	return pid == 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static double haloClock(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1.e-9 * t.tv_nsec;
+}
+
+
+//---------------------------------------------------------------------------
+//	Socket transport
+//---------------------------------------------------------------------------
+
+static bool openSockets(const char* session, unsigned int slab, unsigned int numSlabs)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	//	Listen for the slab above first, so that it can connect to us while
+	//	we are busy connecting to the slab below
+	if (slab > 0)
+	{
+		snprintf(listenPath, sizeof(listenPath), "/tmp/cell_%s_%u.sock", session, slab);
+		unlink(listenPath);
+		listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", listenPath);
+		if (listenFd < 0 || bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+			listen(listenFd, 1) < 0)
+		{
+			std::cerr << "ERROR: cannot listen on " << listenPath << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+	}
+
+	if (slab + 1 < numSlabs)
+	{
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/cell_%s_%u.sock", session, slab+1);
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		//	the slab below may not have started yet
+		while (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+		{
+			if (errno != ENOENT && errno != ECONNREFUSED)
+			{
+				std::cerr << "ERROR: cannot connect to " << addr.sun_path << ": " << strerror(errno) << std::endl;
+				close(fd);
+				return false;
+			}
+			usleep(10000);
+		}
+		sendLink[1].fd = recvLink[1].fd = fd;
+	}
+
+	if (slab > 0)
+	{
+		int fd = accept(listenFd, nullptr, nullptr);
+		if (fd < 0)
+		{
+			std::cerr << "ERROR: accept failed on " << listenPath << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		sendLink[0].fd = recvLink[0].fd = fd;
+	}
+
+	for (int d=0; d<2; d++)
+		if (sendLink[d].fd >= 0)
+			fcntl(sendLink[d].fd, F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+//	Rows can be larger than the socket buffers, so sends and receives on
+//	both links are interleaved with poll rather than done one after the
+//	other (which could deadlock with both neighbors sending).  Returns
+//	false if a neighbor closed its socket or went silent.
+static bool transferRows(unsigned int** grid, unsigned int firstRow, unsigned int lastRow)
+{
+	const size_t rowSize = haloNumCols * sizeof(unsigned int);
+	char* sendBuf[2] = {(char*) grid[firstRow], (char*) grid[lastRow]};
+	char* recvBuf[2] = {nullptr, nullptr};
+	size_t sent[2], received[2];
+	for (int d=0; d<2; d++)
+		sent[d] = received[d] = sendLink[d].fd >= 0 ? 0 : rowSize;
+	if (sendLink[0].fd >= 0)
+		recvBuf[0] = (char*) grid[firstRow-1];
+	if (sendLink[1].fd >= 0)
+		recvBuf[1] = (char*) grid[lastRow+1];
+
+	double lastProgress = haloClock();
+	while (sent[0] < rowSize || sent[1] < rowSize || received[0] < rowSize || received[1] < rowSize)
+	{
+		struct pollfd fds[2];
+		for (int d=0; d<2; d++)
+		{
+			//	links that are done (or absent) are left out of the poll
+			bool done = sent[d] == rowSize && received[d] == rowSize;
+			fds[d].fd = done ? -1 : sendLink[d].fd;
+			fds[d].events = (sent[d] < rowSize ? POLLOUT : 0) | (received[d] < rowSize ? POLLIN : 0);
+			fds[d].revents = 0;
+		}
+		int ready = poll(fds, 2, 1000);
+		if (ready < 0 && errno != EINTR)
+		{
+			std::cerr << "ERROR: poll failed on the halo sockets: " << strerror(errno) << std::endl;
+			return false;
+		}
+		if (ready <= 0)
+		{
+			if (haloClock() - lastProgress > HALO_TIMEOUT)
+			{
+				std::cerr << "ERROR: no halo exchange with the neighboring slabs for " << HALO_TIMEOUT << " s" << std::endl;
+				return false;
+			}
+			continue;
+		}
+		lastProgress = haloClock();
+
+		for (int d=0; d<2; d++)
+		{
+			//	a closed socket reads as end of file (recv returns 0); the
+			//	hangup alone doesn't say whether some data is still in flight
+			bool lost = (fds[d].revents & (POLLERR | POLLNVAL)) != 0;
+			if (!lost && (fds[d].revents & POLLOUT))
+			{
+				ssize_t n = send(fds[d].fd, sendBuf[d] + sent[d], rowSize - sent[d], MSG_NOSIGNAL);
+				if (n > 0)
+					sent[d] += n;
+				else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					lost = true;
+			}
+			if (!lost && (fds[d].revents & (POLLIN | POLLHUP)) && received[d] < rowSize)
+			{
+				ssize_t n = recv(fds[d].fd, recvBuf[d] + received[d], rowSize - received[d], 0);
+				if (n > 0)
+					received[d] += n;
+				else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+					lost = true;
+			}
+			else if (!lost && (fds[d].revents & POLLHUP))
+				lost = true;
+			if (lost)
+			{
+				std::cerr << "ERROR: lost the connection with a neighboring slab" << std::endl;
+				return false;
+			}
+		}
+	}
+	return true;
+}
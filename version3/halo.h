@@ -0,0 +1,32 @@
+//
+//  halo.h
+//  Cellular Automaton
+//
+//	Exchange of one-row halos between cooperating processes that each own
+//	a horizontal slab of the grid.  Process k sends its first row to
+//	process k-1 and its last row to process k+1, and receives the rows
+//	just outside its slab from them.
+//
+
+#ifndef HALO_H
+#define HALO_H
+
+#define HALO_TRANSPORT_SHM		0	//	POSIX shared memory ring buffers
+#define HALO_TRANSPORT_SOCKET	1	//	local stream sockets (stand-in for the networked version)
+
+//	Sets up the links with the neighboring slabs.  session must be unique to
+//	the run: shared memory segments left over by an earlier run of the same
+//	session are refused.  Returns false on failure (closeHaloExchange then
+//	removes the segments, leftovers included).
+bool initHaloExchange(const char* session, unsigned int slab, unsigned int numSlabs,
+					  unsigned int numCols, int transport);
+
+//	Sends rows firstRow and lastRow of the grid to the neighbors, then
+//	fills rows firstRow-1 and lastRow+1 with what they sent.  Blocks until
+//	both halos have been received.  Returns false (the halos are then
+//	unusable) if a neighbor is lost.
+bool exchangeHalos(unsigned int** grid, unsigned int firstRow, unsigned int lastRow);
+
+void closeHaloExchange(void);
+
+#endif // HALO_H
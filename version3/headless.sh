@@ -0,0 +1,22 @@
+#!/bin/bash
+
+
+################## manual ###########################################
+# - launch script: "bash headless.sh rows cols threads --generations G [options]"
+# -
+# - builds cell_headless, which doesn't use (nor link) GL or glut,
+#   and runs it with the arguments given
+# - a run needs --generations G and/or --until-stable
+#
+#
+####################################################################
+
+# compile program
+source "$(dirname "$0")/sources.sh"
+g++ -O2 -DHEADLESS $SOURCES -lm -lpthread -lrt -o $SOURCE_DIR/cell_headless
+if [ ! -f $SOURCE_DIR/cell_headless ]
+then
+	exit 1
+fi
+
+$SOURCE_DIR/cell_headless "$@"
@@ -0,0 +1,395 @@
+//
+//  history.cpp
+//  Cellular Automaton
+//
+//	packedGrid holds the last recorded generation, one bit per cell, each
+//	row padded to whole 64-bit words.  As a worker records a row it packs
+//	it, XORs it with that row of packedGrid and lists the words that
+//	differ, then stores the new words in packedGrid.  The rows of a band
+//	are only touched by its worker, so no lock is needed, and the cells
+//	are read right after being computed, while still in the cache.
+//
+//	Encoding of a delta: for each band, the number of words listed, then
+//	for each word the number of unlisted words since the previous one (since
+//	the start of the grid for the first word of a band) and the XOR word.
+//	Counts are LEB128 varints, the words are stored as is.
+//
+//	Packing is most of the recording cost, so whole words are packed 16
+//	cells at a time with SSE2 where available.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+//
+#include "history.h"
+
+struct HistoryEntry {
+	HistoryEntry* next;
+	int generation;
+	bool keyframe;
+	size_t size;				//	bytes of data, which follow the struct
+};
+
+//---------------------------------------------------------------------------
+//  File-level global variables
+//---------------------------------------------------------------------------
+
+static size_t historyBudget = 0, historyBytes = 0;
+static unsigned int historyKeyframeEvery = 64;
+static unsigned int historyFirstRow = 0, historyLastRow = 0, historyCols = 0;
+static unsigned int wordsPerRow = 0;
+static size_t packedWords = 0;
+static uint64_t* packedGrid = nullptr;
+static HistoryBand* bands = nullptr;
+static unsigned int maxHistoryBands = 0;
+//	oldest entry first
+static HistoryEntry* oldestEntry = nullptr;
+static HistoryEntry* newestEntry = nullptr;
+static int segmentStart = 0;
+
+static void appendEntry(HistoryEntry* entry);
+static void dropOldSegments(void);
+static void dropEntriesFrom(int generation);
+static HistoryEntry* newEntry(int generation, bool keyframe, size_t size);
+static unsigned char* entryData(HistoryEntry* entry);
+static uint64_t packWord(const unsigned int* cells, unsigned int numBits);
+static void packGrid(unsigned int** grid);
+static void applyDelta(uint64_t* packed, const unsigned char* data, size_t size);
+static size_t encodeVarint(unsigned char* out, unsigned long value);
+static void putVarint(HistoryBand* band, unsigned long value);
+static unsigned long getVarint(const unsigned char** src);
+static void putBytes(HistoryBand* band, const void* bytes, size_t n);
+
+
+bool initHistory(size_t budgetBytes, unsigned int keyframeEvery, unsigned int firstRow,
+				 unsigned int lastRow, unsigned int numCols, unsigned int maxBands)
+{
+	historyBudget = budgetBytes;
+	historyKeyframeEvery = keyframeEvery > 0 ? keyframeEvery : 1;
+	historyFirstRow = firstRow;
+	historyLastRow = lastRow;
+	historyCols = numCols;
+	wordsPerRow = (numCols + 63) / 64;
+	packedWords = (size_t) wordsPerRow * (lastRow - firstRow + 1);
+	if (packedWords * sizeof(uint64_t) > budgetBytes)
+	{
+		std::cerr << "ERROR: a history of " << budgetBytes << " bytes can't even hold one generation ("
+				  << packedWords * sizeof(uint64_t) << " bytes)" << std::endl;
+		return false;
+	}
+	packedGrid = static_cast<uint64_t*>(calloc(packedWords, sizeof(uint64_t)));
+	bands = static_cast<HistoryBand*>(calloc(maxBands, sizeof(HistoryBand)));
+	maxHistoryBands = maxBands;
+	return packedGrid != nullptr && bands != nullptr;
+}
+
+
+bool historyActive(void)
+{
+	return packedGrid != nullptr;
+}
+
+
+HistoryBand* historyBand(unsigned int band)
+{
+	return bands + band;
+}
+
+
+void recordHistoryRow(HistoryBand* band, unsigned int i, const unsigned int* row)
+{
+	unsigned long firstWord = (unsigned long) (i - historyFirstRow) * wordsPerRow;
+	uint64_t* packed = packedGrid + firstWord;
+	for (unsigned int w=0; w<wordsPerRow; w++)
+	{
+		unsigned int numBits = historyCols - 64*w < 64 ? historyCols - 64*w : 64;
+		uint64_t word = packWord(row + 64*w, numBits);
+		uint64_t flips = word ^ packed[w];
+		if (flips == 0)
+			continue;
+		packed[w] = word;
+		unsigned long index = firstWord + w;
+		putVarint(band, index - (band->numWords > 0 ? band->lastWord + 1 : 0));
+		putBytes(band, &flips, sizeof(flips));
+		band->lastWord = index;
+		band->numWords++;
+	}
+}
+
+
+void commitHistory(int generation, unsigned int numBands)
+{
+	HistoryEntry* entry;
+	if ((unsigned int) (generation - segmentStart) >= historyKeyframeEvery)
+	{
+		//	the workers have already brought packedGrid up to date
+		entry = newEntry(generation, true, packedWords * sizeof(uint64_t));
+		memcpy(entryData(entry), packedGrid, entry->size);
+		segmentStart = generation;
+	}
+	else
+	{
+		unsigned char count[10];
+		size_t size = 0;
+		for (unsigned int k=0; k<numBands; k++)
+			size += encodeVarint(count, bands[k].numWords) + bands[k].size;
+		entry = newEntry(generation, false, size);
+		unsigned char* out = entryData(entry);
+		for (unsigned int k=0; k<numBands; k++)
+		{
+			out += encodeVarint(out, bands[k].numWords);
+			memcpy(out, bands[k].data, bands[k].size);
+			out += bands[k].size;
+		}
+	}
+	for (unsigned int k=0; k<maxHistoryBands; k++)
+		bands[k].size = bands[k].numWords = 0;
+	appendEntry(entry);
+}
+
+
+void recordHistoryKeyframe(unsigned int** grid, int generation)
+{
+	dropEntriesFrom(generation);
+	packGrid(grid);
+	HistoryEntry* entry = newEntry(generation, true, packedWords * sizeof(uint64_t));
+	memcpy(entryData(entry), packedGrid, entry->size);
+	segmentStart = generation;
+	for (unsigned int k=0; k<maxHistoryBands; k++)
+		bands[k].size = bands[k].numWords = 0;
+	appendEntry(entry);
+}
+
+
+bool restoreHistory(int generation, unsigned int** grid)
+{
+	//	the last keyframe at or before the generation
+	HistoryEntry* keyframe = nullptr;
+	HistoryEntry* entry;
+	for (entry=oldestEntry; entry!=nullptr && entry->generation<=generation; entry=entry->next)
+		if (entry->keyframe)
+			keyframe = entry;
+	if (keyframe == nullptr || newestEntry->generation < generation)
+		return false;
+
+	uint64_t* packed = static_cast<uint64_t*>(malloc(packedWords * sizeof(uint64_t)));
+	if (packed == nullptr)
+		return false;
+	memcpy(packed, entryData(keyframe), packedWords * sizeof(uint64_t));
+	for (entry=keyframe->next; entry!=nullptr && entry->generation<=generation; entry=entry->next)
+		applyDelta(packed, entryData(entry), entry->size);
+
+	for (unsigned int i=historyFirstRow; i<=historyLastRow; i++)
+	{
+		const uint64_t* words = packed + (size_t) (i - historyFirstRow) * wordsPerRow;
+		for (unsigned int j=0; j<historyCols; j++)
+			grid[i][j] = (words[j / 64] >> (j % 64)) & 1;
+	}
+	free(packed);
+	return true;
+}
+
+
+void historyRange(int* oldest, int* newest)
+{
+	*oldest = oldestEntry != nullptr ? oldestEntry->generation : -1;
+	*newest = newestEntry != nullptr ? newestEntry->generation : -1;
+}
+
+
+void closeHistory(void)
+{
+	dropEntriesFrom(-1);
+	for (unsigned int k=0; k<maxHistoryBands; k++)
+		free(bands[k].data);
+	free(bands);
+	free(packedGrid);
+	bands = nullptr;
+	packedGrid = nullptr;
+}
+
+
+static void appendEntry(HistoryEntry* entry)
+{
+	if (newestEntry != nullptr)
+		newestEntry->next = entry;
+	else
+		oldestEntry = entry;
+	newestEntry = entry;
+	historyBytes += sizeof(HistoryEntry) + entry->size;
+	dropOldSegments();
+}
+
+//	Drops the oldest segment as long as the history is over budget and
+//	there is a more recent one
+static void dropOldSegments(void)
+{
+	while (historyBytes > historyBudget)
+	{
+		HistoryEntry* nextKeyframe = oldestEntry->next;
+		while (nextKeyframe != nullptr && !nextKeyframe->keyframe)
+			nextKeyframe = nextKeyframe->next;
+		if (nextKeyframe == nullptr)
+			break;
+		while (oldestEntry != nextKeyframe)
+		{
+			HistoryEntry* entry = oldestEntry;
+			oldestEntry = entry->next;
+			historyBytes -= sizeof(HistoryEntry) + entry->size;
+			free(entry);
+		}
+	}
+}
+
+static void dropEntriesFrom(int generation)
+{
+	HistoryEntry** link = &oldestEntry;
+	newestEntry = nullptr;
+	while (*link != nullptr && (*link)->generation < generation)
+	{
+		newestEntry = *link;
+		link = &(*link)->next;
+	}
+	HistoryEntry* entry = *link;
+	*link = nullptr;
+	while (entry != nullptr)
+	{
+		HistoryEntry* next = entry->next;
+		historyBytes -= sizeof(HistoryEntry) + entry->size;
+		free(entry);
+		entry = next;
+	}
+}
+
+static HistoryEntry* newEntry(int generation, bool keyframe, size_t size)
+{
+	HistoryEntry* entry = static_cast<HistoryEntry*>(malloc(sizeof(HistoryEntry) + size));
+	if (entry == nullptr)
+	{
+		std::cerr << "ERROR: out of memory for the history" << std::endl;
+		exit(1);
+	}
+	entry->next = nullptr;
+	entry->generation = generation;
+	entry->keyframe = keyframe;
+	entry->size = size;
+	return entry;
+}
+
+static unsigned char* entryData(HistoryEntry* entry)
+{
+	return reinterpret_cast<unsigned char*>(entry + 1);
+}
+
+//	Bit b of the word is set if cells[b] is alive
+static uint64_t packWord(const unsigned int* cells, unsigned int numBits)
+{
+	uint64_t word = 0;
+#ifdef __SSE2__
+	if (numBits == 64)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		for (unsigned int b=0; b<64; b+=16)
+		{
+			const __m128i* in = reinterpret_cast<const __m128i*>(cells + b);
+			__m128i dead0 = _mm_cmpeq_epi32(_mm_loadu_si128(in), zero);
+			__m128i dead1 = _mm_cmpeq_epi32(_mm_loadu_si128(in + 1), zero);
+			__m128i dead2 = _mm_cmpeq_epi32(_mm_loadu_si128(in + 2), zero);
+			__m128i dead3 = _mm_cmpeq_epi32(_mm_loadu_si128(in + 3), zero);
+			__m128i dead = _mm_packs_epi16(_mm_packs_epi32(dead0, dead1), _mm_packs_epi32(dead2, dead3));
+			word |= (uint64_t) (~_mm_movemask_epi8(dead) & 0xFFFF) << b;
+		}
+		return word;
+	}
+#endif
+	for (unsigned int b=0; b<numBits; b++)
+		word |= (uint64_t) (cells[b] != 0) << b;
+	return word;
+}
+
+static void packGrid(unsigned int** grid)
+{
+	for (unsigned int i=historyFirstRow; i<=historyLastRow; i++)
+	{
+		uint64_t* words = packedGrid + (size_t) (i - historyFirstRow) * wordsPerRow;
+		for (unsigned int w=0; w<wordsPerRow; w++)
+			words[w] = packWord(grid[i] + 64*w, historyCols - 64*w < 64 ? historyCols - 64*w : 64);
+	}
+}
+
+static void applyDelta(uint64_t* packed, const unsigned char* data, size_t size)
+{
+	const unsigned char* end = data + size;
+	while (data < end)
+	{
+		unsigned long numWords = getVarint(&data);
+		unsigned long index = 0;
+		for (unsigned long n=0; n<numWords; n++)
+		{
+			index += getVarint(&data);
+			uint64_t flips;
+			memcpy(&flips, data, sizeof(flips));
+			data += sizeof(flips);
+			packed[index++] ^= flips;
+		}
+	}
+}
+
+//	Writes at most 10 bytes, returns how many
+static size_t encodeVarint(unsigned char* out, unsigned long value)
+{
+	size_t n = 0;
+	do {
+		out[n] = (unsigned char) (value & 0x7F);
+		value >>= 7;
+		if (value != 0)
+			out[n] |= 0x80;
+		n++;
+	} while (value != 0);
+	return n;
+}
+
+static void putVarint(HistoryBand* band, unsigned long value)
+{
+	unsigned char bytes[10];
+	putBytes(band, bytes, encodeVarint(bytes, value));
+}
+
+static unsigned long getVarint(const unsigned char** src)
+{
+	unsigned long value = 0;
+	int shift = 0;
+	unsigned char byte;
+	do {
+		byte = *(*src)++;
+		value |= (unsigned long) (byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return value;
+}
+
+static void putBytes(HistoryBand* band, const void* bytes, size_t n)
+{
+	if (band->size + n > band->capacity)
+	{
+		size_t capacity = band->capacity > 0 ? 2 * band->capacity : 4096;
+		while (capacity < band->size + n)
+			capacity *= 2;
+		unsigned char* data = static_cast<unsigned char*>(realloc(band->data, capacity));
+		if (data == nullptr)
+		{
+			std::cerr << "ERROR: out of memory for the history" << std::endl;
+			exit(1);
+		}
+		band->data = data;
+		band->capacity = capacity;
+	}
+	memcpy(band->data + band->size, bytes, n);
+	band->size += n;
+}
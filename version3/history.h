@@ -0,0 +1,62 @@
+//
+//  history.h
+//  Cellular Automaton
+//
+//	Bounded history of the past generations, so that the simulation can be
+//	rewound.  The history is a list of segments, each made of a keyframe
+//	(the whole grid, one bit per cell) followed by the generations after it
+//	as XOR deltas: the 64-bit words of the packed grid that differ from
+//	the previous generation, each with its distance to the previous word
+//	listed.  A segment ends after keyframeEvery generations, or when the
+//	grid is replaced.  When the history exceeds its budget, the oldest
+//	segments are dropped whole (the segment being recorded is always kept).
+//
+//	Only the alive/dead state is kept: in color mode, a generation brought
+//	back from the history starts with all its live cells newborn.
+//
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cstddef>
+
+//	Encoded delta of one band, filled by its worker only
+typedef struct HistoryBand {
+	unsigned char* data;
+	size_t size, capacity;
+	unsigned long numWords;		//	words listed
+	unsigned long lastWord;		//	index of the last word listed
+} HistoryBand;
+
+//	Sets up a history of at most budgetBytes for rows firstRow to lastRow of
+//	a grid of numCols columns, recorded by at most maxBands workers.
+//	Returns false on failure.
+bool initHistory(size_t budgetBytes, unsigned int keyframeEvery, unsigned int firstRow,
+				 unsigned int lastRow, unsigned int numCols, unsigned int maxBands);
+
+bool historyActive(void);
+
+HistoryBand* historyBand(unsigned int band);
+
+//	Called by the worker of a band, in increasing order, for each row i it
+//	has computed, with the new states of the row
+void recordHistoryRow(HistoryBand* band, unsigned int i, const unsigned int* row);
+
+//	Called by the last worker to finish a generation: adds the bands just
+//	recorded (the first numBands, in row order) as the given generation
+void commitHistory(int generation, unsigned int numBands);
+
+//	Starts a new segment with grid as its keyframe, after dropping any
+//	generation from the given one on (same caller as commitHistory)
+void recordHistoryKeyframe(unsigned int** grid, int generation);
+
+//	Rebuilds a retained generation into rows firstRow to lastRow of grid
+//	(0 or 1 per cell).  Returns false if it isn't in the history.
+bool restoreHistory(int generation, unsigned int** grid);
+
+//	Oldest and newest generation retained (-1 if none)
+void historyRange(int* oldest, int* newest);
+
+void closeHistory(void);
+
+#endif // HISTORY_H
@@ -24,13 +24,19 @@
  |		- 'c' --> toggle color mode on/off									|
  |		- 'b' --> toggles color mode off/on									|
  |		- 'l' --> toggles on/off grid line rendering						|
+ |		- 'z' --> zoom back out to the whole grid							|
+ |		- mouse wheel --> zoom in/out about the cursor						|
+ |		- left drag --> pan the zoomed-in view								|
  |																			|
  |		- '+' --> increase simulation speed									|
  |		- '-' --> reduce simulation speed									|
  |																			|
+ |		- '>' --> add one worker thread										|
+ |		- '<' --> remove one worker thread									|
+ |																			|
  |		- '1' --> apply Rule 1 (Conway's classical Game of Life: B3/S23)	|
  |		- '2' --> apply Rule 2 (Coral: B3/S45678)							|
- |		- '3' --> apply Rule 3 (Amoeba: B357/S1358)							|
+ |		- '3' --> apply Rule 3 (Amoeba: B1358/S1358)						|
  |		- '4' --> apply Rule 4 (Maze: B3/S12345)							|
  |																			|
  +-------------------------------------------------------------------------*/
@@ -45,19 +51,62 @@
 #include <sys/stat.h> 
 #include <sys/types.h> 
 #include <cstring>
+#include <cmath>
 #include <string>
+#include <atomic>
+#include <algorithm>
 //
 #include "gl_frontEnd.h"
+#include "halo.h"
+#include "ensemble.h"
+#include "frameExport.h"
+#include "control.h"
+#include "commands.h"
+#include "checkpoint.h"
+#include "pattern.h"
+#include "gridStore.h"
+#include "deltaStream.h"
+#include "history.h"
+#include "metrics.h"
+#include "trace.h"
+#include "perfCounters.h"
+#include "verify.h"
 
 #define PIPE "/tmp/pipe"
 //==================================================================================
 //	Custom data types
 //==================================================================================
-using ThreadInfo = struct {
+//	Aligned on cache lines, so that the counters that a worker keeps
+//	updating never share a line with those of another worker
+using ThreadInfo = struct alignas(64) {
 	pthread_t id;
 	unsigned int index;
 	unsigned int startRow, endRow;
 	pthread_mutex_t lock;
+	//	time spent computing the band, accumulated over the current
+	//	rebalancing period, and the average per generation over the last one
+	double bandTime;
+	double lastBandTime;
+	//	the band just computed is identical to what it was two generations
+	//	ago (the previous content of nextGrid)
+	bool bandRepeats;
+	//	dashboard counters, updated by the worker with relaxed stores and
+	//	sampled by the front end: live cells in the band at the last
+	//	generation, nanoseconds spent computing and waiting at the barrier
+	//	(see recordBarrierWait)
+	std::atomic<unsigned long> population;
+	std::atomic<unsigned long> computeNs, waitNs;
+	//	exported metrics (see metrics.h): time spent waiting for the
+	//	other workers and the leader at each generation, and cells computed
+	MetricHistogram waitTime;
+	std::atomic<unsigned long> cellsUpdated;
+};
+
+//	The settings that the workers use for a whole generation
+using GenerationConfig = struct {
+	unsigned int rule;
+	unsigned int colorMode;
+	unsigned int speed;
 };
 
 
@@ -70,8 +119,36 @@ void initializeApplication(void);
 void* threadFunc(void*);
 void swapGrids(void);
 unsigned int cellNewState(unsigned int i, unsigned int j);
+unsigned int cellNewStateIn(unsigned int** grid, unsigned int nRows, unsigned int nCols,
+							unsigned int gridRule, unsigned int i, unsigned int j);
 void createThreads(void);
-void* readPipe(void*);
+void assignBands(void);
+bool spawnThread(unsigned int k);
+void spawnMissingThreads(void);
+void resizeThreadPool(unsigned int selfIndex);
+void refreshHalos(void);
+void recordBarrierWait(ThreadInfo* info, double waitStart, unsigned long release);
+void rebalanceBands(void);
+double currentTime(void);
+void parseOptions(int argc, char** argv);
+void waitForEndOfRun(void);
+void runHeadless(void);
+void cleanupAndQuit(void);
+void applyCommands(void);
+void requestNumThreads(unsigned int n);
+unsigned int nextRandom(void);
+unsigned long seedRandom(unsigned int seed);
+unsigned int nextRandomFrom(unsigned long* state);
+bool saveState(const char* path);
+bool restoreState(const char* path);
+bool placePattern(const char* spec, bool onEmptyGrid);
+bool rewindTo(int target);
+void clearGrid(void);
+void sampleDashboard(void);
+double latencyPercentile(const unsigned long* counts, double q);
+double stepPercentile(double q);
+void formatWaits(int thread, char* text, size_t size);
+unsigned long currentPopulation(void);
 //==================================================================================
 //	Precompiler #define to let us specify how things should be handled at the
 //	border of the frame
@@ -82,16 +159,21 @@ void* readPipe(void*);
 #define FRAME_CLIPPED	2	//	same rule as elsewhere, with clipping to stay within bounds
 #define FRAME_WRAP		3	//	same rule as elsewhere, with wrapping around at edges
 
-//	Pick one value for FRAME_BEHAVIOR
+//	Pick one value for FRAME_BEHAVIOR (or define it when compiling, as the
+//	benchmark does: -DFRAME_BEHAVIOR=3)
+#ifndef FRAME_BEHAVIOR
 #define FRAME_BEHAVIOR	FRAME_DEAD
+#endif
 
 //==================================================================================
 //	Application-level global variables
 //==================================================================================
 
 //	Don't touch
+#ifndef HEADLESS
 extern int GRID_PANE, STATE_PANE;
 extern int gMainWindow, gSubwindow[2];
+#endif
 
 //	The state grid and its dimensions.  We now have two copies of the grid:
 //		- currentGrid is the one displayed in the graphic front end
@@ -100,6 +182,19 @@ extern int gMainWindow, gSubwindow[2];
 unsigned int** currentGrid;
 unsigned int** nextGrid;
 
+//	Dirty-row tracking, so that the renderer only re-uploads what changed:
+//		- rowChanged[i] is set by the worker that computed row i of nextGrid
+//			if any cell differs from currentGrid,
+//		- at each swap, changed rows are flagged in rowDirty, which the
+//			renderer clears as it uploads them.
+//	The renderer reads currentGrid without any lock, so the leader counts
+//	the swaps: a buffer swapped out during a render may already hold rows
+//	of a later generation, and the rows read then are uploaded again.
+unsigned char* rowChanged;
+std::atomic<unsigned char>* rowDirty;
+unsigned char* rowUpload;
+std::atomic<unsigned long> gridSwaps(0);
+
 //	Piece of advice, whenever you do a grid-based (e.g. image processing),
 //	you should always try to run your code with a non-square grid to
 //	spot accidental row-col inversion bugs.
@@ -109,19 +204,186 @@ unsigned int numRows = 400, numCols = 420;
 unsigned int maxNumThreads = 10;
 unsigned int numLiveThreads = 0;
 
+//	The worker pool can be resized at runtime.  threadInfo is allocated
+//	for threadCapacity workers so that the structs never move; workers
+//	beyond maxNumThreads stay parked on their lock.
+#define MAX_NUM_THREADS	256
+unsigned int threadCapacity = 0;
+unsigned int numSpawnedThreads = 0;
+
+//	Pool size requested by the pipe or the keyboard.  It is applied by the
+//	last thread to finish a generation (0 means no pending request).
+std::atomic<unsigned int> requestedNumThreads(0);
+
+//	Every REBALANCE_PERIOD generations the band boundaries are moved toward
+//	equal compute times, unless the spread between the slowest and the
+//	fastest band is below REBALANCE_THRESHOLD (fraction of the average).
+#define REBALANCE_PERIOD	8
+#define REBALANCE_THRESHOLD	0.1
+
 unsigned int rule = GAME_OF_LIFE_RULE;
 unsigned int speed = 5000;
 
 unsigned int colorMode = 0;
 
-ThreadInfo* threadInfo;
+//	rule, colorMode and speed are only changed by the last worker of a
+//	generation, as it applies the queued commands (see commands.h).  It then
+//	publishes them in generationConfig, which the workers copy as they
+//	start a generation.
+GenerationConfig generationConfig;
+
+//	Predefine some colors for "age"-based rendering of the cells (also the
+//	palette of the exported frames)
+float cellColor[NB_COLORS][4] = {	{0.f, 0.f, 0.f, 1.f},	//	BLACK_COL
+									{1.f, 1.f, 1.f, 1.f},	//	WHITE_COL,
+									{0.f, 0.f, 1.f, 1.f},	//	BLUE_COL,
+									{0.f, 1.f, 0.f, 1.f},	//	GREEN_COL,
+									{1.f, 1.f, 0.f, 1.f},	//	YELLOW_COL,
+									{1.f, 0.f, 0.f, 1.f}};	//	RED_COL
+
+ThreadInfo* threadInfo = nullptr;
 
 int generation = 0;
 
+//	Headless mode: no window, the workers run flat out until the end of the
+//	run, then the throughput and final state are reported.  A build with
+//	HEADLESS defined does not use (nor link) GL/glut at all.
+#ifdef HEADLESS
+bool headless = true;
+#else
+bool headless = false;
+#endif
+
+//	Stop after that many generations (0 means run forever), or as soon as
+//	the grid settles (still life or period 2 oscillators only) if
+//	stopWhenStable is set
+unsigned int maxGenerations = 0;
+bool stopWhenStable = false;
+bool gridChanged = true;
+bool runFinished = false;
+pthread_mutex_t runFinishedLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t runFinishedCond = PTHREAD_COND_INITIALIZER;
+
+//	Multi-process mode: the grid is split into numSlabs horizontal slabs,
+//	one per cooperating process, and this process owns the rows
+//	firstOwnedRow to lastOwnedRow.  The rows just outside of the slab are
+//	halos refreshed from the neighboring processes at every generation.
+//	With a single slab, the process owns the whole grid.
+unsigned int numSlabs = 1, slabIndex = 0;
+unsigned int firstOwnedRow = 0, lastOwnedRow = 0;
+int haloTransport = HALO_TRANSPORT_SHM;
+const char* haloSession = NULL;
+
+//	Ensemble mode: run that many independent random soups instead of the
+//	interactive simulation.  seed is used for the soups (0 means time-based)
+unsigned int ensembleSize = 0;
+unsigned int seed = 0;
+
+//	Generator of the random soups (xorshift64*).  It is explicit, rather
+//	than rand(), so that its state can be saved with the grid.
+unsigned long rngState = 1;
+
+//	Checkpoints: the run can start from loadPath, and a headless run saves
+//	its final state to savePath.  startGeneration is the generation the
+//	run started from.
+const char* loadPath = nullptr;
+const char* savePath = nullptr;
+int startGeneration = 0;
+
+//	Patterns (file[@row,col]) that the run starts from, instead of a soup
+#define MAX_PATTERNS	16
+const char* patternSpecs[MAX_PATTERNS];
+unsigned int numPatterns = 0;
+
+//	Out-of-core mode: the two grids are files in backingDir (see gridStore.h)
+const char* backingDir = nullptr;
+
+//	Frame export: every frameEvery-th generation is written to framePath.
+//	frameBuffer is the frame that the workers fill while computing the
+//	current generation (nullptr if that one isn't exported)
+const char* framePath = nullptr;
+unsigned int frameEvery = 1;
+int frameFormat = FRAME_FORMAT_INDEXED;
+unsigned char* frameBuffer = nullptr;
+
+//	Delta stream: the flips of every generation are written to deltaPath.
+//	deltaRecord is the record that the workers fill while computing the
+//	current generation (nullptr without a delta stream)
+const char* deltaPath = nullptr;
+DeltaRecord* deltaRecord = nullptr;
+
+//	Rewind history (see history.h): historyMB megabytes at most, with a
+//	keyframe every keyframeEvery generations (0 MB: no history)
+unsigned int historyMB = 0;
+unsigned int keyframeEvery = 64;
+
+//	Unix domain socket on which the control channel also takes commands
+//	and queries, with replies (see control.h)
+const char* controlSocketPath = nullptr;
+
 unsigned int threadsDoneCount = 0;
 pthread_mutex_t threadCountLock;
 
+//	Histogram of the compute time of a generation (from the moment the
+//	workers are released to the arrival of the last one).  Only the last
+//	worker of a generation records into it, the front end samples it.
+MetricHistogram generationLatency;
+double generationStart = 0.;
+
+//	Number of times the leader released the workers, and how long it slept
+//	(the speed setting) before the last release.  Both are written by the
+//	leader before it unlocks the workers.
+unsigned long numReleases = 0;
+double throttleTime = 0.;
+
+//	The same, one entry per generation of a headless run with a fixed
+//	length, from which the report gives exact percentiles
+double* stepTimes = nullptr;
+unsigned int numStepTimes = 0;
+
+//	Time spent drawing the grid pane, recorded by the front end
+MetricHistogram renderTime;
+
+//	Metrics server address: a port number or a socket path (see metrics.h)
+const char* metricsAddress = nullptr;
+
+//	Timeline of the threads (see trace.h): size of the ring of each thread,
+//	and where to write it at the end of the run, if anywhere
+#define DEFAULT_TRACE_EVENTS	65536
+unsigned int traceEvents = 0;
+const char* tracePath = nullptr;
+
+//	Every generation is checked against the reference path (see verify.h).
+//	The run stops at the first mismatch, and the process exits with 1.
+bool verifyRun = false;
+bool verifyFailed = false;
+
+//	Performance counters of the threads (see perfCounters.h), folded into
+//	a window every perfPeriod generations; 0 when off or not available
+unsigned int perfPeriod = 0;
+
+//	Two successive samples of the counters.  The rates, percentiles and
+//	wait fractions shown in the state pane (and given to the control
+//	socket's clients) are computed over the interval between them,
+//	refreshed at most every DASHBOARD_PERIOD seconds.  The front end's timer
+//	and the control thread both take samples, under dashboardLock.
+#define DASHBOARD_PERIOD	0.5
+using DashboardSample = struct {
+	double time;
+	int generation;
+	unsigned long latency[METRIC_BUCKETS];
+	unsigned long computeNs[MAX_NUM_THREADS], waitNs[MAX_NUM_THREADS];
+};
+DashboardSample dashboardSample[2];
+unsigned int lastSample = 0;
+double generationRate = 0., cellUpdateRate = 0.;
+double latencyP50 = 0., latencyP99 = 0.;
+double waitFraction[MAX_NUM_THREADS];
+pthread_mutex_t dashboardLock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifndef HEADLESS
 extern int drawGridLines;
+#endif
 //==================================================================================
 //	These are the functions that tie the simulation with the rendering.
 //	Some parts are "don't touch."  Other parts need your intervention
@@ -129,8 +391,11 @@ extern int drawGridLines;
 //==================================================================================
 
 
+#ifndef HEADLESS
 void displayGridPane(void)
 {
+	double renderStart = currentTime();
+	perfPhaseStart();
 	//	This is OpenGL/glut magic.  Don't touch
 	glutSetWindow(gSubwindow[GRID_PANE]);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -141,11 +406,25 @@ void displayGridPane(void)
 	//	This is the call that makes OpenGL render the grid.
 	//
 	//---------------------------------------------------------
-	drawGrid(currentGrid, numRows, numCols);
+	unsigned long swaps = gridSwaps.load(std::memory_order_acquire);
+	unsigned int** grid = currentGrid;
+	for (unsigned int i = 0; i < numRows; i++)
+		rowUpload[i] = rowDirty[i].exchange(0, std::memory_order_acquire);
+	drawGrid(grid, numRows, numCols, rowUpload);
+	//	if the grid was swapped meanwhile, what was read may mix generations
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (gridSwaps.load(std::memory_order_relaxed) != swaps)
+		for (unsigned int i = 0; i < numRows; i++)
+			if (rowUpload[i])
+				rowDirty[i].store(1, std::memory_order_release);
 	
 	//	This is OpenGL/glut magic.  Don't touch
 	glutSwapBuffers();
 	glutSetWindow(gMainWindow);
+	double renderEnd = currentTime();
+	perfPhaseEnd(PERF_PHASE_RENDER);
+	observeMetric(&renderTime, renderEnd - renderStart);
+	traceEvent("render", renderStart, renderEnd, generation);
 }
 
 void displayStatePane(void)
@@ -161,7 +440,38 @@ void displayStatePane(void)
 	//	about the state of the simulation.
 	//
 	//---------------------------------------------------------
-	drawState(numLiveThreads);
+	//	performance summary, then per-thread band and load, as measured
+	//	over the last rebalancing period, and barrier wait fraction.  With
+	//	the performance counters, one line per phase after the summary.
+	const unsigned int MAX_INFO_LINES = 40;
+	char lineBuffer[MAX_INFO_LINES][80];
+	const char* infoLines[MAX_INFO_LINES];
+	snprintf(lineBuffer[0], 80, "Generation %d  population %lu", generation, currentPopulation());
+	snprintf(lineBuffer[1], 80, "%.1f gen/s  %.3g cell updates/s", generationRate, cellUpdateRate);
+	snprintf(lineBuffer[2], 80, "Generation time p50 %.2f ms  p99 %.2f ms", latencyP50, latencyP99);
+	unsigned int numInfoLines = 3;
+	if (perfPeriod > 0) {
+		PerfTotals totals;
+		perfWindow(&totals);
+		for (int p = 0; p < PERF_NUM_PHASES; p++)
+			formatPerfPhase(&totals, p, lineBuffer[numInfoLines++], 80);
+	}
+	unsigned int numSummaryLines = numInfoLines;
+	double totalTime = 0.;
+	for (unsigned int k = 0; k < maxNumThreads; k++)
+		totalTime += threadInfo[k].lastBandTime;
+	for (unsigned int k = 0; k < maxNumThreads && numInfoLines < MAX_INFO_LINES; k++) {
+		double share = totalTime > 0. ? 100. * threadInfo[k].lastBandTime / totalTime : 0.;
+		double wait = k < MAX_NUM_THREADS ? 100. * waitFraction[k] : 0.;
+		snprintf(lineBuffer[numInfoLines], 80, "T%u  rows %u-%u  %.2f ms  (%.0f%%)  wait %.0f%%", k,
+				 threadInfo[k].startRow, threadInfo[k].endRow,
+				 1000. * threadInfo[k].lastBandTime, share, wait);
+		infoLines[numInfoLines] = lineBuffer[numInfoLines];
+		numInfoLines++;
+	}
+	for (unsigned int k = 0; k < numSummaryLines; k++)
+		infoLines[k] = lineBuffer[k];
+	drawState(numLiveThreads, infoLines, numInfoLines);
 	
 	
 	//	This is OpenGL/glut magic.  Don't touch
@@ -169,31 +479,314 @@ void displayStatePane(void)
 	glutSetWindow(gMainWindow);
 }
 
+#endif
+
+//	Called by the front end's timer and for the queries of the control
+//	socket: takes a new sample of the counters and recomputes what the
+//	state pane shows over the interval since the last one
+void sampleDashboard(void)
+{
+	pthread_mutex_lock(&dashboardLock);
+	double now = currentTime();
+	DashboardSample* last = dashboardSample + lastSample;
+	if (threadInfo == nullptr || now - last->time < DASHBOARD_PERIOD) {
+		pthread_mutex_unlock(&dashboardLock);
+		return;
+	}
+	DashboardSample* sample = dashboardSample + (1 - lastSample);
+
+	sample->time = now;
+	sample->generation = generation;
+	for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+		sample->latency[b] = generationLatency.counts[b].load(std::memory_order_relaxed);
+	for (unsigned int k = 0; k < MAX_NUM_THREADS && k < threadCapacity; k++) {
+		sample->computeNs[k] = threadInfo[k].computeNs.load(std::memory_order_relaxed);
+		sample->waitNs[k] = threadInfo[k].waitNs.load(std::memory_order_relaxed);
+	}
+
+	//	the very first sample only serves as a reference
+	lastSample = 1 - lastSample;
+	if (last->time == 0.) {
+		pthread_mutex_unlock(&dashboardLock);
+		return;
+	}
+
+	double interval = now - last->time;
+	generationRate = (sample->generation - last->generation) / interval;
+	cellUpdateRate = generationRate * (lastOwnedRow - firstOwnedRow + 1) * numCols;
+
+	unsigned long counts[METRIC_BUCKETS];
+	for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+		counts[b] = sample->latency[b] - last->latency[b];
+	latencyP50 = latencyPercentile(counts, 0.50);
+	latencyP99 = latencyPercentile(counts, 0.99);
+
+	for (unsigned int k = 0; k < MAX_NUM_THREADS && k < threadCapacity; k++) {
+		double compute = (double) (sample->computeNs[k] - last->computeNs[k]);
+		double wait = (double) (sample->waitNs[k] - last->waitNs[k]);
+		waitFraction[k] = compute + wait > 0. ? wait / (compute + wait) : 0.;
+	}
+	pthread_mutex_unlock(&dashboardLock);
+}
+
+//	Latency (in ms) below which a fraction q of the counted generations
+//	fall (see histogramPercentile)
+double latencyPercentile(const unsigned long* counts, double q)
+{
+	return 1.e-3 * histogramPercentile(counts, q);
+}
+
+//	Generation time (in ms) below which a fraction q of the generations of
+//	a headless run fall (falls back on the histogram for open-ended runs)
+double stepPercentile(double q)
+{
+	if (numStepTimes == 0) {
+		unsigned long counts[METRIC_BUCKETS];
+		for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+			counts[b] = generationLatency.counts[b].load(std::memory_order_relaxed);
+		return latencyPercentile(counts, q);
+	}
+	std::sort(stepTimes, stepTimes + numStepTimes);
+	return 1000. * stepTimes[(unsigned int) (q * (numStepTimes - 1))];
+}
+
+//	Barrier waits of a worker (or of all the workers that ever ran, merged,
+//	if thread is -1): percentiles in µs, total, and the share of the
+//	worker's time spent waiting rather than computing
+void formatWaits(int thread, char* text, size_t size)
+{
+	unsigned long counts[METRIC_BUCKETS] = {0}, total = 0;
+	double waitNs = 0., computeNs = 0.;
+	unsigned int numThreads = threadInfo != nullptr ? numSpawnedThreads : 0;
+	for (unsigned int k = 0; k < numThreads; k++) {
+		if (thread >= 0 && k != (unsigned int) thread)
+			continue;
+		for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+			counts[b] += threadInfo[k].waitTime.counts[b].load(std::memory_order_relaxed);
+		waitNs += threadInfo[k].waitTime.sumNs.load(std::memory_order_relaxed);
+		computeNs += threadInfo[k].computeNs.load(std::memory_order_relaxed);
+	}
+	for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+		total += counts[b];
+	snprintf(text, size, "waits %lu wait-p50-us %.1f wait-p90-us %.1f wait-p99-us %.1f wait-max-us %.1f"
+			 " wait-total-s %.3f wait-fraction %.1f%%",
+			 total, histogramPercentile(counts, 0.50), histogramPercentile(counts, 0.90),
+			 histogramPercentile(counts, 0.99), histogramMax(counts), 1.e-9 * waitNs,
+			 waitNs + computeNs > 0. ? 100. * waitNs / (waitNs + computeNs) : 0.);
+}
+
+//	Live cells at the last generation each band completed
+unsigned long currentPopulation(void)
+{
+	unsigned long population = 0;
+	for (unsigned int k = 0; threadInfo != nullptr && k < maxNumThreads; k++)
+		population += threadInfo[k].population.load(std::memory_order_relaxed);
+	return population;
+}
+
+//	Called by the metrics server for each scrape (see metrics.h)
+void collectMetrics(MetricsText* text)
+{
+	metricHeader(text, "cell_generation", "gauge", "Last generation computed");
+	metricValue(text, "cell_generation", nullptr, generation);
+	metricHeader(text, "cell_population", "gauge", "Live cells");
+	metricValue(text, "cell_population", nullptr, currentPopulation());
+	metricHeader(text, "cell_worker_threads", "gauge", "Active worker threads");
+	metricValue(text, "cell_worker_threads", nullptr, numLiveThreads);
+	metricHeader(text, "cell_command_queue_depth", "gauge", "Commands waiting for the next generation");
+	metricValue(text, "cell_command_queue_depth", nullptr, pendingCommands());
+
+	metricHeader(text, "cell_generation_latency_seconds", "histogram",
+				 "Time from the start of a generation to the arrival of its last worker");
+	metricHistogram(text, "cell_generation_latency_seconds", nullptr, &generationLatency);
+	if (!headless) {
+		metricHeader(text, "cell_render_seconds", "histogram", "Time to draw the grid pane");
+		metricHistogram(text, "cell_render_seconds", nullptr, &renderTime);
+	}
+
+	//	per worker, for every worker that ever ran
+	unsigned int numThreads = threadInfo != nullptr ? numSpawnedThreads : 0;
+	char labels[32];
+	metricHeader(text, "cell_barrier_wait_seconds", "histogram",
+				 "Time a worker waits for the others at the end of a generation");
+	for (unsigned int k = 0; k < numThreads; k++) {
+		snprintf(labels, sizeof(labels), "thread=\"%u\"", k);
+		metricHistogram(text, "cell_barrier_wait_seconds", labels, &threadInfo[k].waitTime);
+	}
+	metricHeader(text, "cell_compute_seconds_total", "counter", "Time a worker spent computing its band");
+	for (unsigned int k = 0; k < numThreads; k++) {
+		snprintf(labels, sizeof(labels), "thread=\"%u\"", k);
+		metricValue(text, "cell_compute_seconds_total", labels,
+					1.e-9 * threadInfo[k].computeNs.load(std::memory_order_relaxed));
+	}
+	metricHeader(text, "cell_cells_updated_total", "counter", "Cells computed by a worker");
+	for (unsigned int k = 0; k < numThreads; k++) {
+		snprintf(labels, sizeof(labels), "thread=\"%u\"", k);
+		metricValue(text, "cell_cells_updated_total", labels,
+					(double) threadInfo[k].cellsUpdated.load(std::memory_order_relaxed));
+	}
+
+	//	performance counters of all the threads, per phase
+	if (perfPeriod > 0) {
+		PerfTotals totals;
+		perfRunTotals(&totals, generation);
+		char perfLabels[64];
+		metricHeader(text, "cell_perf_events_total", "counter",
+					 "Performance counter events (task-clock in ns), per phase");
+		int numPhases = headless ? PERF_PHASE_RENDER : PERF_NUM_PHASES;
+		for (int p = 0; p < numPhases; p++)
+			for (int e = 0; e < PERF_NUM_EVENTS; e++)
+				if (perfEventAvailable(e)) {
+					snprintf(perfLabels, sizeof(perfLabels), "phase=\"%s\",event=\"%s\"",
+							 perfPhaseName(p), perfEventName(e));
+					metricValue(text, "cell_perf_events_total", perfLabels, totals.count[p][e]);
+				}
+	}
+}
+
 //------------------------------------------------------------------------
 //	You shouldn't have to change anything in the main function
 //------------------------------------------------------------------------
 int main(int argc, char** argv) {
-	if (argc != 4) {
+	if (argc < 4) {
 		fprintf(stderr, "cell program launched with incorrect number of arguments.\n"
-			"Proper usage: ./cell [number of rows] [number of cols] [max number of live threads]\n"
-			"Suggested values: rows: 400, cols: 420, threads: 10\n");
+			"Proper usage: ./cell [number of rows] [number of cols] [max number of live threads] [options]\n"
+			"Suggested values: rows: 400, cols: 420, threads: 10\n"
+			"Options:\n"
+			"    --headless               no window: run, then report the throughput\n"
+			"    --generations G          stop after G generations\n"
+			"    --until-stable           stop when the grid repeats with a period of 1 or 2\n"
+			"    --rule R                 start with rule R (1 to 4)\n"
+			"    --seed S                 seed of the random generator\n"
+			"    --ensemble N             run N independent rows x cols soups, no window\n"
+			"    --slab K N               own slab K of N cooperating processes (no window)\n"
+			"    --transport shm|socket   how halos are exchanged between slabs\n"
+			"    --session NAME           unique name shared by the cooperating processes of\n"
+			"                             a run (required with --slab)\n"
+			"    --frames PATH            write raw frames to PATH (a file, a FIFO, or - for stdout)\n"
+			"    --frame-every N          only export every Nth generation\n"
+			"    --frame-format F         indexed (one byte per cell) or packed (one bit per cell)\n"
+			"    --load PATH              start from a checkpoint (rows and cols are taken from it)\n"
+			"    --save PATH              write a checkpoint at the end of a headless run\n"
+			"    --pattern FILE[@R,C]     start from an RLE, Life 1.06 or plaintext pattern,\n"
+			"                             with its top left corner at row R, col C (default:\n"
+			"                             centered; row 0 is the bottom row).  Can be repeated.\n"
+			"    --backing-dir DIR        keep the grids in files in DIR rather than in memory\n"
+			"    --delta PATH             write the cells that flip at each generation to PATH\n"
+			"                             (a file, a FIFO, or - for stdout)\n"
+			"    --history-mb M           keep up to M MB of past generations for rewind/seek\n"
+			"    --keyframe-every K       full grid in the history every K generations (64)\n"
+			"    --control-socket PATH    also take commands and queries on a Unix socket\n"
+			"    --metrics PORT|PATH      serve Prometheus metrics on a local port or socket\n"
+			"    --trace PATH             record a timeline of the threads, written to PATH\n"
+			"                             at the end (or at any time with \"trace PATH\")\n"
+			"    --trace-events N         events kept per thread (65536)\n"
+			"    --perf-counters N        count cycles, instructions, cache and branch misses\n"
+			"                             per phase, reported over windows of N generations\n"
+			"    --color                  start in color mode\n"
+			"    --verify                 check every generation against the reference path\n");
 		exit(1);
 	}
 	numRows = (unsigned int)strtoul(argv[1], NULL, 10);
 	numCols = (unsigned int)strtoul(argv[2], NULL, 10);
 	maxNumThreads = (unsigned int)strtoul(argv[3], NULL, 10);
+	parseOptions(argc, argv);
+
+	if (ensembleSize > 0) {
+		runEnsemble(ensembleSize, numRows, numCols, maxNumThreads,
+					maxGenerations > 0 ? maxGenerations : 1000, rule, seed);
+		exit(0);
+	}
+
+	//	a slab of a multi-process run has no window of its own
+	if (numSlabs > 1)
+		headless = true;
+	if (headless && maxGenerations == 0 && !stopWhenStable) {
+		fprintf(stderr, "A headless run needs --generations or --until-stable\n");
+		exit(1);
+	}
+	if (!headless && savePath != NULL) {
+		fprintf(stderr, "--save needs a headless run (use the save command otherwise)\n");
+		exit(1);
+	}
 
+#ifndef HEADLESS
 	//	This takes care of initializing glut and the GUI.
 	//	You shouldn’t have to touch this
-	initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
-	
+	if (!headless)
+		initializeFrontEnd(argc, argv, displayGridPane, displayStatePane);
+#endif
 
 	//	Now we can do application-level initialization
 	initializeApplication();
 
-	// call the communication to pipe
-	pthread_t ReaderID;
-	pthread_create(&ReaderID, NULL, &readPipe, NULL);
+	//	--generations counts from the generation of the checkpoint
+	if (loadPath != NULL) {
+		if (!restoreState(loadPath))
+			exit(1);
+		startGeneration = generation;
+		if (maxGenerations > 0)
+			maxGenerations += generation;
+	}
+	//	patterns replace the soup, or go on top of the checkpoint
+	for (unsigned int k = 0; k < numPatterns; k++)
+		if (!placePattern(patternSpecs[k], k == 0 && loadPath == NULL))
+			exit(1);
+
+	if (numSlabs > 1) {
+		if (!initHaloExchange(haloSession, slabIndex, numSlabs, numCols, haloTransport)) {
+			closeHaloExchange();
+			exit(1);
+		}
+		refreshHalos();
+	}
+
+	if (framePath != NULL) {
+		if (!initFrameExport(framePath, numRows, numCols, frameEvery, frameFormat))
+			exit(1);
+		frameBuffer = beginFrame(generation + 1);
+	}
+
+	//	the stream starts with the whole grid
+	if (deltaPath != NULL) {
+		if (!initDeltaStream(deltaPath, numRows, numCols,
+							 maxNumThreads > MAX_NUM_THREADS ? maxNumThreads : MAX_NUM_THREADS))
+			exit(1);
+		writeDeltaKeyframe(currentGrid, firstOwnedRow, lastOwnedRow, generation);
+		deltaRecord = beginDeltas(generation + 1);
+	}
+
+	if (historyMB > 0) {
+		if (!initHistory((size_t) historyMB << 20, keyframeEvery, firstOwnedRow, lastOwnedRow, numCols,
+						 maxNumThreads > MAX_NUM_THREADS ? maxNumThreads : MAX_NUM_THREADS))
+			exit(1);
+		recordHistoryKeyframe(currentGrid, generation);
+	}
+
+	if (verifyRun && !initVerify(currentGrid, numRows, numCols))
+		exit(1);
+
+	if (metricsAddress != NULL && !startMetricsServer(metricsAddress))
+		exit(1);
+
+	if (traceEvents > 0 || tracePath != NULL) {
+		initTrace(traceEvents > 0 ? traceEvents : DEFAULT_TRACE_EVENTS);
+		traceThread("main");
+	}
+
+	//	a machine without counters only loses the reports
+	if (perfPeriod > 0 && !initPerfCounters())
+		perfPeriod = 0;
+
+	if (headless) {
+		if (controlSocketPath != NULL && !startControlChannel(NULL, controlSocketPath))
+			exit(1);
+		runHeadless();
+	}
+
+#ifndef HEADLESS
+	// commands from the pipe
+	startControlChannel(PIPE, controlSocketPath);
 	
 	//	Now would be the place & time to create mutex locks and threads
 	createThreads();
@@ -202,6 +795,7 @@ int main(int argc, char** argv) {
 	//	we set up earlier will be called when the corresponding event
 	//	occurs
 	glutMainLoop();
+#endif
 	
 	//	This will never be executed (the exit point will be in one of the
 	//	call back functions).
@@ -215,81 +809,312 @@ int main(int argc, char** argv) {
 //
 //==================================================================================
 
-void* readPipe(void*){
-	// array stores pipe values
-	int max_buf = 1000; 
-	char buf[1000];
-    // listener loops until user enters "end"
-	bool temp = true;
-	while(temp == true){
-		int fd = open(PIPE, O_RDONLY);
-		if (fd<0){
-			printf("PIPE DOES NOT EXIST!!!");
-			break;
+void parseOptions(int argc, char** argv) {
+	for (int k = 4; k < argc; k++) {
+		if (!strcmp(argv[k], "--headless"))
+			headless = true;
+		else if (!strcmp(argv[k], "--generations") && k + 1 < argc)
+			maxGenerations = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--until-stable"))
+			stopWhenStable = true;
+		else if (!strcmp(argv[k], "--rule") && k + 1 < argc) {
+			rule = (unsigned int)strtoul(argv[++k], NULL, 10);
+			if (rule < GAME_OF_LIFE_RULE || rule > MAZE_RULE) {
+				fprintf(stderr, "Invalid rule number\n");
+				exit(1);
+			}
+		}
+		else if (!strcmp(argv[k], "--seed") && k + 1 < argc)
+			seed = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--color"))
+			colorMode = 1;
+		else if (!strcmp(argv[k], "--verify"))
+			verifyRun = true;
+		else if (!strcmp(argv[k], "--ensemble") && k + 1 < argc)
+			ensembleSize = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--slab") && k + 2 < argc) {
+			slabIndex = (unsigned int)strtoul(argv[++k], NULL, 10);
+			numSlabs = (unsigned int)strtoul(argv[++k], NULL, 10);
+		}
+		else if (!strcmp(argv[k], "--transport") && k + 1 < argc)
+			haloTransport = !strcmp(argv[++k], "socket") ? HALO_TRANSPORT_SOCKET : HALO_TRANSPORT_SHM;
+		else if (!strcmp(argv[k], "--session") && k + 1 < argc)
+			haloSession = argv[++k];
+		else if (!strcmp(argv[k], "--frames") && k + 1 < argc)
+			framePath = argv[++k];
+		else if (!strcmp(argv[k], "--frame-every") && k + 1 < argc)
+			frameEvery = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--frame-format") && k + 1 < argc)
+			frameFormat = !strcmp(argv[++k], "packed") ? FRAME_FORMAT_PACKED : FRAME_FORMAT_INDEXED;
+		else if (!strcmp(argv[k], "--load") && k + 1 < argc)
+			loadPath = argv[++k];
+		else if (!strcmp(argv[k], "--save") && k + 1 < argc)
+			savePath = argv[++k];
+		else if (!strcmp(argv[k], "--pattern") && k + 1 < argc && numPatterns < MAX_PATTERNS)
+			patternSpecs[numPatterns++] = argv[++k];
+		else if (!strcmp(argv[k], "--backing-dir") && k + 1 < argc)
+			backingDir = argv[++k];
+		else if (!strcmp(argv[k], "--delta") && k + 1 < argc)
+			deltaPath = argv[++k];
+		else if (!strcmp(argv[k], "--history-mb") && k + 1 < argc)
+			historyMB = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--keyframe-every") && k + 1 < argc)
+			keyframeEvery = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--control-socket") && k + 1 < argc)
+			controlSocketPath = argv[++k];
+		else if (!strcmp(argv[k], "--metrics") && k + 1 < argc)
+			metricsAddress = argv[++k];
+		else if (!strcmp(argv[k], "--trace") && k + 1 < argc)
+			tracePath = argv[++k];
+		else if (!strcmp(argv[k], "--trace-events") && k + 1 < argc)
+			traceEvents = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else if (!strcmp(argv[k], "--perf-counters") && k + 1 < argc)
+			perfPeriod = (unsigned int)strtoul(argv[++k], NULL, 10);
+		else {
+			fprintf(stderr, "Unknown or incomplete option %s\n", argv[k]);
+			exit(1);
 		}
+	}
+	if (seed == 0)
+		seed = (unsigned int) time(NULL);
+	//	a default name would let a run pick up the segments of an earlier one
+	if (numSlabs > 1 && haloSession == NULL) {
+		fprintf(stderr, "--slab needs a --session name unique to the run\n");
+		exit(1);
+	}
+	if (numSlabs > 1 && stopWhenStable) {
+		fprintf(stderr, "--until-stable is not supported for multi-process runs\n");
+		exit(1);
+	}
+	if (numSlabs > 1 && framePath != NULL) {
+		fprintf(stderr, "--frames is not supported for multi-process runs\n");
+		exit(1);
+	}
+	if (numSlabs > 1 && deltaPath != NULL) {
+		fprintf(stderr, "--delta is not supported for multi-process runs\n");
+		exit(1);
+	}
+	if (numSlabs > 1 && historyMB > 0) {
+		fprintf(stderr, "--history-mb is not supported for multi-process runs\n");
+		exit(1);
+	}
+	//	the rows of the other edge belong to another process
+	if (numSlabs > 1 && FRAME_BEHAVIOR == FRAME_WRAP) {
+		fprintf(stderr, "a build with wrapping edges does not support multi-process runs\n");
+		exit(1);
+	}
+	if (verifyRun && numSlabs > 1) {
+		fprintf(stderr, "--verify is not supported for multi-process runs\n");
+		exit(1);
+	}
+	//	random borders can't be reproduced by the reference
+	if (verifyRun && FRAME_BEHAVIOR == FRAME_RANDOM) {
+		fprintf(stderr, "--verify is not supported by a build with random borders\n");
+		exit(1);
+	}
+	if (deltaPath != NULL && framePath != NULL && !strcmp(deltaPath, "-") && !strcmp(framePath, "-")) {
+		fprintf(stderr, "--frames and --delta cannot both go to stdout\n");
+		exit(1);
+	}
+	if (numSlabs > 1 && (loadPath != NULL || savePath != NULL)) {
+		fprintf(stderr, "--load and --save are not supported for multi-process runs\n");
+		exit(1);
+	}
+	//	the checkpoint decides the dimensions of the grid
+	if (loadPath != NULL) {
+		CheckpointInfo info;
+		if (!readCheckpointInfo(loadPath, &info))
+			exit(1);
+		numRows = info.numRows;
+		numCols = info.numCols;
+	}
+	if (numSlabs == 0 || slabIndex >= numSlabs || numRows < 3 * numSlabs) {
+		fprintf(stderr, "Invalid slab %u of %u for %u rows\n", slabIndex, numSlabs, numRows);
+		exit(1);
+	}
+	firstOwnedRow = (unsigned int)(((unsigned long) slabIndex * numRows) / numSlabs);
+	lastOwnedRow = (unsigned int)(((unsigned long) (slabIndex + 1) * numRows) / numSlabs) - 1;
+}
 
-		// take input from pipe as string
-		ssize_t size = read(fd, buf, max_buf);
-		buf[size] = '\0';
+//	Runs the simulation without a window until the end of the run, then
+//	reports the throughput and the final state of the (owned part of the)
+//	grid, and quits
+void runHeadless(void) {
+	//	no point in slowing down the simulation
+	speed = 0;
+	if (maxGenerations > (unsigned int) startGeneration)
+		stepTimes = new double[maxGenerations - startGeneration];
 
-		std::string str(buf);
+	double startTime = currentTime();
+	createThreads();
+	waitForEndOfRun();
+	double elapsed = currentTime() - startTime;
 
-        //printf("PIPE STUFF:   %s", buf); 
-        close(fd);   
+	if (savePath != NULL && !saveState(savePath))
+		exit(1);
 
-		if(!strcmp(buf, "end\0")){
-			std::cout<<"test1 -----		";
-			temp == false;
-			break;
+	unsigned long population = 0;
+	for (unsigned int i = firstOwnedRow; i <= lastOwnedRow; i++)
+		for (unsigned int j = 0; j < numCols; j++)
+			population += currentGrid[i][j] != 0;
+	int numGenerations = generation - startGeneration;
+	double cellUpdates = (double) numGenerations * (lastOwnedRow - firstOwnedRow + 1) * numCols;
+	//	stdout may be taken by the frames or the deltas
+	bool stdoutTaken = (framePath != NULL && !strcmp(framePath, "-")) ||
+					   (deltaPath != NULL && !strcmp(deltaPath, "-"));
+	FILE* report = stdoutTaken ? stderr : stdout;
+	if (numSlabs > 1)
+		fprintf(report, "slab %u ", slabIndex);
+	fprintf(report, "rows %u-%u generation %d population %lu elapsed %.3f s %.1f generations/s %.0f cell updates/s"
+		   " p50-ms %.3f p99-ms %.3f\n",
+		   firstOwnedRow, lastOwnedRow, generation, population, elapsed,
+		   elapsed > 0. ? numGenerations / elapsed : 0., elapsed > 0. ? cellUpdates / elapsed : 0.,
+		   stepPercentile(0.50), stepPercentile(0.99));
+	char waits[160];
+	formatWaits(-1, waits, sizeof(waits));
+	fprintf(report, "barrier %s\n", waits);
+	if (perfPeriod > 0) {
+		PerfTotals totals;
+		char text[128];
+		perfRunTotals(&totals, numGenerations);
+		//	(no rendering here)
+		for (int p = 0; p < PERF_PHASE_RENDER; p++) {
+			formatPerfPhase(&totals, p, text, sizeof(text));
+			fprintf(report, "perf %s\n", text);
 		}
-		else if(!strcmp(buf, "end\0")){
-			std::cout<<"test2 -----		";
-			speed *= 9;
-			speed /= 10;
-		}
-		else if(!strcmp(buf, "end\0")){
-			std::cout<<"test3 -----		";			
-			speed *= 11;
-			speed /= 10;
-		}
-		else if(!strcmp(buf, "rule 1\0")) rule = GAME_OF_LIFE_RULE;
-		else if(!strcmp(buf, "rule 2\0")) rule = CORAL_GROWTH_RULE;
-		else if(!strcmp(buf, "rule 3\0")) rule = AMOEBA_RULE;
-		else if(!strcmp(buf, "rule 4\0")) rule = MAZE_RULE;
-		else if(!strcmp(buf, "color on\0")) || !strcmp(buf, "color off\0")) colorMode = !colorMode;
-		else if(!strcmp(buf, "line\0")) drawGridLines = !drawGridLines;
-		else if(!strcmp(buf, "reset\0")) resetGrid();
-
-
-
-		// if( str.compare("end") == 1){
-		// 	std::cout<<"test1 -----		";
-		// 	temp == false;
-		// 	break;
-		// }
-		// else if( str.compare("faster") == 1){
-		// 	std::cout<<"test2 -----		";
-		// 	speed *= 9;
-		// 	speed /= 10;
-		// }
-		// else if( str.compare("slower")== 1){
-		// 	std::cout<<"test3 -----		";			
-		// 	speed *= 11;
-		// 	speed /= 10;
-		// }
-		// else if( str.compare("rule 1") == 1) rule = GAME_OF_LIFE_RULE;
-		// else if( str.compare("rule 2") == 1) rule = CORAL_GROWTH_RULE;
-		// else if( str.compare("rule 3") == 1) rule = AMOEBA_RULE;
-		// else if( str.compare("rule 4") == 1) rule = MAZE_RULE;
-		// else if( str.compare("color on") == 1 || str.compare("color off") == 1) colorMode = !colorMode;
-		// else if( str.compare("line") == 1) drawGridLines = !drawGridLines;
-		// else if( str.compare("reset") == 1) resetGrid();
-		else{
-			std::cout<<"Invalid command!!\n";		
-		}
-	   std::cout<<"String: "<<buf<<"   Size:"<<size<<" \n";
 	}
+	if (verifyActive())
+		fprintf(report, "verify: %lu generations match the reference%s\n", verifiedGenerations(),
+				verifyFailed ? ", then a mismatch" : "");
+
+	if (numSlabs > 1)
+		closeHaloExchange();
+	cleanupAndQuit();
+}
+
+//	A slab that lost a neighbor can't compute its edge rows any more: the
+//	process stops, and the other slabs will notice in turn
+void refreshHalos(void) {
+	if (!exchangeHalos(currentGrid, firstOwnedRow, lastOwnedRow)) {
+		std::cerr << "ERROR: slab " << slabIndex << " stops at generation " << generation << std::endl;
+		closeHaloExchange();
+		exit(1);
+	}
+}
+
+//	Blocks the caller until the workers have computed maxGenerations generations
+void waitForEndOfRun(void) {
+	pthread_mutex_lock(&runFinishedLock);
+	while (!runFinished)
+		pthread_cond_wait(&runFinishedCond, &runFinishedLock);
+	pthread_mutex_unlock(&runFinishedLock);
+}
 
+//	Commands of the control channel (see control.h), e.g. from bash.sh.
+//	Commands are only queued: "ok" means that they will apply from the next
+//	generation on.  Queries are answered right away.
+bool handleCommand(const char* line, char* reply, size_t replySize) {
+	unsigned int numThreads, ruleNumber, numGenerations, targetGeneration;
+	double start = traceActive() ? currentTime() : 0.;
+	snprintf(reply, replySize, "ok");
+	if (!strcmp(line, "end"))
+		return false;
+	//	would only change the rows of this slab (see applyCommands)
+	else if (numSlabs > 1 && (!strcmp(line, "reset") || !strcmp(line, "clear") || !strncmp(line, "pattern ", 8) ||
+							  !strncmp(line, "save ", 5) || !strncmp(line, "load ", 5)))
+		snprintf(reply, replySize, "error not supported for multi-process runs");
+	else if (!strcmp(line, "faster"))
+		postCommand(COMMAND_FASTER, 0);
+	else if (!strcmp(line, "slower"))
+		postCommand(COMMAND_SLOWER, 0);
+	else if (sscanf(line, "rule %u", &ruleNumber) == 1 &&
+			 ruleNumber >= GAME_OF_LIFE_RULE && ruleNumber <= MAZE_RULE)
+		postCommand(COMMAND_RULE, (int) ruleNumber);
+	else if (!strcmp(line, "color on"))
+		postCommand(COMMAND_COLOR, 1);
+	else if (!strcmp(line, "color off"))
+		postCommand(COMMAND_COLOR, 0);
+#ifndef HEADLESS
+	else if (!strcmp(line, "line"))
+		drawGridLines = !drawGridLines;
+#endif
+	else if (!strcmp(line, "reset"))
+		postCommand(COMMAND_RESET, 0);
+	else if (sscanf(line, "threads %u", &numThreads) == 1)
+		postCommand(COMMAND_THREADS, (int) numThreads);
+	else if (!strncmp(line, "save ", 5) && line[5] != '\0')
+		postCommand(COMMAND_SAVE, 0, line + 5);
+	else if (!strncmp(line, "load ", 5) && line[5] != '\0')
+		postCommand(COMMAND_LOAD, 0, line + 5);
+	else if (!strncmp(line, "pattern ", 8) && line[8] != '\0')
+		postCommand(COMMAND_PATTERN, 0, line + 8);
+	else if (!strcmp(line, "clear"))
+		postCommand(COMMAND_CLEAR, 0);
+	else if (sscanf(line, "rewind %u", &numGenerations) == 1)
+		postCommand(COMMAND_REWIND, (int) numGenerations);
+	else if (sscanf(line, "seek %u", &targetGeneration) == 1)
+		postCommand(COMMAND_SEEK, (int) targetGeneration);
+	//	queries
+	else if (!strcmp(line, "generation"))
+		snprintf(reply, replySize, "generation %d", generation);
+	else if (!strcmp(line, "population"))
+		snprintf(reply, replySize, "population %lu", currentPopulation());
+	else if (!strcmp(line, "rates")) {
+		sampleDashboard();
+		pthread_mutex_lock(&dashboardLock);
+		snprintf(reply, replySize, "generations/s %.1f cell-updates/s %.0f p50-ms %.3f p99-ms %.3f",
+				 generationRate, cellUpdateRate, latencyP50, latencyP99);
+		pthread_mutex_unlock(&dashboardLock);
+	}
+	else if (!strcmp(line, "status")) {
+		const GenerationConfig config = generationConfig;
+		snprintf(reply, replySize, "generation %d population %lu rule %u color %s speed %u threads %u rows %u cols %u",
+				 generation, currentPopulation(), config.rule, config.colorMode ? "on" : "off", config.speed,
+				 numLiveThreads, numRows, numCols);
+	}
+	else if (!strcmp(line, "history")) {
+		int oldest = -1, newest = -1;
+		if (historyActive())
+			historyRange(&oldest, &newest);
+		snprintf(reply, replySize, "history %d %d", oldest, newest);
+	}
+	else if (!strncmp(line, "trace ", 6) && line[6] != '\0') {
+		unsigned long numEvents;
+		if (!traceActive())
+			snprintf(reply, replySize, "error tracing is off (see --trace)");
+		else if (dumpTrace(line + 6, &numEvents))
+			snprintf(reply, replySize, "ok %lu events", numEvents);
+		else
+			snprintf(reply, replySize, "error cannot write %s", line + 6);
+	}
+	else if (!strcmp(line, "waits"))
+		formatWaits(-1, reply, replySize);
+	else if (sscanf(line, "waits %u", &numThreads) == 1) {
+		if (numThreads < numSpawnedThreads)
+			formatWaits((int) numThreads, reply, replySize);
+		else
+			snprintf(reply, replySize, "error no thread %u", numThreads);
+	}
+	else if (!strcmp(line, "perf")) {
+		if (perfPeriod == 0)
+			snprintf(reply, replySize, "error no performance counters (see --perf-counters)");
+		else {
+			PerfTotals totals;
+			perfWindow(&totals);
+			size_t n = snprintf(reply, replySize, "generations %lu", totals.generations);
+			int numPhases = headless ? PERF_PHASE_RENDER : PERF_NUM_PHASES;
+			for (int p = 0; p < numPhases && n < replySize; p++) {
+				n += snprintf(reply + n, replySize - n, " ");
+				if (n < replySize)
+					formatPerfPhase(&totals, p, reply + n, replySize - n);
+				n += strlen(reply + n);
+			}
+		}
+	}
+	else
+		snprintf(reply, replySize, "error invalid command: %s", line);
+	traceSpan("command", start, -1);
+	return true;
 }
 
 
@@ -300,15 +1125,40 @@ void cleanupAndQuit(void)
 	//	Free allocated resource before leaving (not absolutely needed, but
 	//	just nicer.  Also, if you crash there, you know something is wrong
 	//	in your code.
-    for (unsigned int i=1; i<numRows; i++)
-    {
-        delete []currentGrid[i];
-        delete []nextGrid[i];
-    }
+	stopControlChannel();
+	stopMetricsServer();
+	if (tracePath != NULL) {
+		unsigned long numEvents;
+		dumpTrace(tracePath, &numEvents);
+	}
+	closeFrameExport();
+	closeDeltaStream();
+	if (historyActive())
+		closeHistory();
+	if (gridStoreActive())
+		closeGridStore();
+	else
+	{
+		for (unsigned int i=0; i<numRows; i++)
+		{
+			delete []currentGrid[i];
+			delete []nextGrid[i];
+		}
+	}
 	delete []currentGrid;
 	delete []nextGrid;
-
-	exit(0);
+	delete []rowChanged;
+	delete []rowDirty;
+	delete []rowUpload;
+	closeVerify();
+
+	//	(a headless run has reported them already)
+	if (!headless && threadInfo != nullptr) {
+		char waits[160];
+		formatWaits(-1, waits, sizeof(waits));
+		printf("barrier %s\n", waits);
+	}
+	exit(verifyFailed ? 1 : 0);
 }
 
 
@@ -317,12 +1167,36 @@ void initializeApplication(void)
 {
     //  Allocate 2D grids
     //--------------------
+    //  A slab only allocates the rows it owns and its two halo rows.  The
+    //  row pointers are still indexed by global row so that cellNewState
+    //  works unchanged.
     currentGrid = new unsigned int*[numRows];
     nextGrid = new unsigned int*[numRows];
     for (unsigned int i=0; i<numRows; i++)
     {
-        currentGrid[i] = new unsigned int[numCols];
-        nextGrid[i] = new unsigned int[numCols];
+        if (backingDir != NULL)
+            currentGrid[i] = nextGrid[i] = nullptr;
+        else if (i+1 >= firstOwnedRow && i <= lastOwnedRow+1)
+        {
+            currentGrid[i] = new unsigned int[numCols]();
+            nextGrid[i] = new unsigned int[numCols]();
+        }
+        else
+            currentGrid[i] = nextGrid[i] = nullptr;
+    }
+    if (backingDir != NULL)
+    {
+        unsigned int firstRow = firstOwnedRow > 0 ? firstOwnedRow - 1 : 0;
+        unsigned int lastRow = lastOwnedRow + 1 < numRows ? lastOwnedRow + 1 : lastOwnedRow;
+        if (!openGridStore(backingDir, firstRow, lastRow, numCols, currentGrid, nextGrid))
+            exit(1);
+    }
+    rowChanged = new unsigned char[numRows]();
+    rowDirty = new std::atomic<unsigned char>[numRows];
+    rowUpload = new unsigned char[numRows];
+    for (unsigned int i=0; i<numRows; i++)
+    {
+        rowDirty[i] = 1;
     }
 	
 	//---------------------------------------------------------------
@@ -334,7 +1208,7 @@ void initializeApplication(void)
 	//	simulation), only some color, in meant-to-be-thrown-away code
 	
 	//	seed the pseudo-random generator
-	srand((unsigned int) time(NULL));
+	rngState = seedRandom(seed + 7919U * slabIndex);
 	
 	resetGrid();
 }
@@ -348,17 +1222,39 @@ void* threadFunc(void* arg)
 	ThreadInfo* info = static_cast<ThreadInfo*>(arg);
 	
 	bool keepGoing = true;
+	double bandEnd = 0.;
+	char traceName[32];
+	snprintf(traceName, sizeof(traceName), "worker %u", info->index);
+	traceThread(traceName);
+	//	wait to be released with the others for the first generation
+	pthread_mutex_lock(&(info->lock));
 	while (keepGoing) {
+		const GenerationConfig config = generationConfig;
+		double startTime = currentTime();
+		perfPhaseEnd(PERF_PHASE_BARRIER);
+		unsigned int differs = 0;
+		unsigned long live = 0;
+		GridWindow window;
+		beginGridWindow(&window, info->startRow);
+		//	flips are listed as runs, as a by-product of the computation
+		DeltaBand* flips = deltaRecord != nullptr ? deltaBand(deltaRecord, info->index) : nullptr;
+		HistoryBand* history = historyActive() ? historyBand(info->index) : nullptr;
 		//std::cout << "startrow: " << info << std::endl;
 		for (unsigned int i = info->startRow; i <= info->endRow; i++)
 		{
+			unsigned int changed = 0;
+			unsigned int runStart = 0;
+			bool inRun = false;
+			if (flips != nullptr)
+				beginDeltaRow(flips, i);
 			for (unsigned int j = 0; j < numCols; j++)
 			{
-				unsigned int newState = cellNewState(i, j);
+				unsigned int newState = cellNewStateIn(currentGrid, numRows, numCols, config.rule, i, j);
+				unsigned int olderState = nextGrid[i][j];
 
 				//	In black and white mode, only alive/dead matters
 				//	Dead is dead in any mode
-				if (colorMode == 0 || newState == 0) {
+				if (config.colorMode == 0 || newState == 0) {
 					nextGrid[i][j] = newState;
 				}
 				//	in color mode, color reflext the "age" of a live cell
@@ -371,8 +1267,43 @@ void* threadFunc(void* arg)
 					else
 						nextGrid[i][j] = currentGrid[i][j];
 				}
+				changed |= nextGrid[i][j] ^ currentGrid[i][j];
+				differs |= nextGrid[i][j] ^ olderState;
+				live += nextGrid[i][j] != 0;
+				if (flips != nullptr) {
+					bool flipped = (nextGrid[i][j] != 0) != (currentGrid[i][j] != 0);
+					if (flipped != inRun) {
+						if (flipped)
+							runStart = j;
+						else
+							addDeltaRun(flips, runStart, j - runStart);
+						inRun = flipped;
+					}
+				}
 			}
+			if (flips != nullptr) {
+				if (inRun)
+					addDeltaRun(flips, runStart, numCols - runStart);
+				endDeltaRow(flips);
+			}
+			rowChanged[i] = changed != 0;
+			if (frameBuffer != nullptr)
+				writeFrameRow(frameBuffer, i, nextGrid[i]);
+			if (history != nullptr)
+				recordHistoryRow(history, i, nextGrid[i]);
+			if (backingDir != NULL)
+				advanceGridWindow(&window, currentGrid, nextGrid, i, i == info->endRow);
 		}
+		info->bandRepeats = differs == 0;
+		bandEnd = currentTime();
+		perfPhaseEnd(PERF_PHASE_COMPUTE);
+		info->bandTime += bandEnd - startTime;
+		info->population.store(live, std::memory_order_relaxed);
+		info->computeNs.fetch_add((unsigned long) (1e9 * (bandEnd - startTime)), std::memory_order_relaxed);
+		info->cellsUpdated.fetch_add((unsigned long) (info->endRow - info->startRow + 1) * numCols,
+									 std::memory_order_relaxed);
+		traceEvent("compute band", startTime, bandEnd, generation);
+
 		// I am done for this generation
 		pthread_mutex_lock(&threadCountLock);
 		threadsDoneCount++;
@@ -381,37 +1312,252 @@ void* threadFunc(void* arg)
 		if (threadsDoneCount == maxNumThreads) {
 			pthread_mutex_unlock(&threadCountLock);
 			// Can only be done by the last thread to finish its load
+			//	(the leader's steps are traced one after the other)
+			observeMetric(&generationLatency, bandEnd - generationStart);
+			if (stepTimes != nullptr && numStepTimes < maxGenerations - startGeneration)
+				stepTimes[numStepTimes++] = bandEnd - generationStart;
 			swapGrids();
-			usleep(speed);
+			double step = traceSpan("swap", bandEnd, generation);
+			throttleTime = 0.;
+			if (config.speed > 0) {
+				double sleepStart = currentTime();
+				usleep(config.speed);
+				throttleTime = currentTime() - sleepStart;
+				step = traceSpan("sleep", step, generation);
+			}
 			threadsDoneCount = 0;
 			generation++;  //? not T 04:42
 			//threadsDoneCount = 0; // reset to 0 ????
 
-			// wake up the other threads
-			for (unsigned int k = 0; k < maxNumThreads; k++) {
-				if (k != info->index)
-					pthread_mutex_unlock(&(threadInfo[k].lock));
+			//	refresh the halo rows of the grid we just swapped in
+			if (numSlabs > 1) {
+				refreshHalos();
+				step = traceSpan("halos", step, generation);
+			}
+
+			//	check the generation just computed, with the settings it
+			//	was computed with
+			if (verifyActive()) {
+				verifyFailed = !verifyGeneration(currentGrid, generation, config.rule, config.colorMode);
+				step = traceSpan("verify", step, generation);
+			}
+
+			if (perfPeriod > 0 && generation % perfPeriod == 0)
+				foldPerfCounters(generation);
+
+			if (generation % REBALANCE_PERIOD == 0) {
+				rebalanceBands();
+				step = traceSpan("rebalance", step, generation);
 			}
+
+			//	hand the generation just computed to the frame writer, the
+			//	delta writer and the history
+			publishFrame();
+			publishDeltas(maxNumThreads);
+			if (historyActive())
+				commitHistory(generation, maxNumThreads);
+			step = traceSpan("publish", step, generation);
+
+			//	changes requested during this generation apply to the next
+			//	(they may replace the grid, or even change the generation),
+			//	then get the buffers for the next one
+			applyCommands();
+			step = traceSpan("commands", step, generation);
+			frameBuffer = beginFrame(generation + 1);
+			deltaRecord = beginDeltas(generation + 1);
+			step = traceSpan("buffers", step, generation);
+
+			//	End of the run: don't wake anybody up
+			//	The grid has settled if nothing changed, or if every band is
+			//	back to what it was two generations ago
+			bool settled = !gridChanged;
+			if (!settled && generation > 2) {
+				settled = true;
+				for (unsigned int k = 0; k < maxNumThreads; k++)
+					settled = settled && threadInfo[k].bandRepeats;
+			}
+			if ((maxGenerations > 0 && (unsigned int) generation >= maxGenerations) ||
+				(stopWhenStable && settled) || verifyFailed) {
+				pthread_mutex_lock(&runFinishedLock);
+				runFinished = true;
+				pthread_cond_signal(&runFinishedCond);
+				pthread_mutex_unlock(&runFinishedLock);
+				pthread_mutex_lock(&(info->lock));
+			}
+
+			// Apply a pending resize while all the other workers are parked.
+			// This also wakes up the other threads and spawns new ones.
+			generationStart = currentTime();
+			numReleases++;
+			resizeThreadPool(info->index);
+			traceSpan("release", step, generation);
+
+			// If this thread was retired by the resize, park it as well
+			if (info->index >= maxNumThreads)
+				pthread_mutex_lock(&(info->lock));
 		}
 		else {
+			unsigned long release = numReleases;
 			pthread_mutex_unlock(&threadCountLock);
 			// and wait for the rest of the threads to finish
+			double waitStart = currentTime();
 			pthread_mutex_lock(&(info->lock));
+			recordBarrierWait(info, waitStart, release);
 		}
 	}
 	return nullptr;
 }
 
+//	The barrier wait of a worker is the time it was blocked on its lock,
+//	less the leader's sleep, which only reflects the speed setting.  The
+//	leader itself never waits (its serial steps are in the trace), and a
+//	worker that stayed parked over several releases (retired, then brought
+//	back by a resize) was idle rather than waiting.
+void recordBarrierWait(ThreadInfo* info, double waitStart, unsigned long release)
+{
+	double waitEnd = currentTime();
+	if (numReleases != release + 1)
+		return;
+	double wait = waitEnd - waitStart - throttleTime;
+	if (wait < 0.)
+		wait = 0.;
+	info->waitNs.fetch_add((unsigned long) (1e9 * wait), std::memory_order_relaxed);
+	observeMetric(&info->waitTime, wait);
+	traceEvent("barrier wait", waitStart, waitEnd, generation);
+}
+
+
+unsigned int nextRandom(void)
+{
+	return nextRandomFrom(&rngState);
+}
+
+//	State of the generator for a seed (xorshift needs a non-zero state).
+//	The ensemble runner seeds its soups the same way, so that soup k can
+//	be replayed with --seed seed+k.
+unsigned long seedRandom(unsigned int seed)
+{
+	unsigned long state = 0x9E3779B97F4A7C15UL * (seed + 1UL);
+	return state != 0 ? state : 1;
+}
+
+unsigned int nextRandomFrom(unsigned long* state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (unsigned int) ((*state * 0x2545F4914F6CDD1DUL) >> 32);
+}
+
+//	Can only be called when the workers are parked (or not started yet)
+bool saveState(const char* path)
+{
+	CheckpointInfo info;
+	info.numRows = numRows;
+	info.numCols = numCols;
+	info.rule = rule;
+	info.frameBehavior = FRAME_BEHAVIOR;
+	info.colorMode = colorMode;
+	info.generation = generation;
+	info.rngState = rngState;
+	return saveCheckpoint(path, currentGrid, &info, maxNumThreads);
+}
+
+//	Same as saveState.  The checkpoint is decoded into nextGrid, then
+//	swapped in like a reset.
+bool restoreState(const char* path)
+{
+	CheckpointInfo info;
+	if (!loadCheckpoint(path, nextGrid, numRows, numCols, &info, maxNumThreads))
+		return false;
+	if (info.frameBehavior != FRAME_BEHAVIOR)
+		fprintf(stderr, "Warning: checkpoint %s was saved with frame behavior %u, this build uses %d\n",
+				path, info.frameBehavior, FRAME_BEHAVIOR);
+	if (info.rule >= GAME_OF_LIFE_RULE && info.rule <= MAZE_RULE)
+		rule = info.rule;
+	colorMode = info.colorMode;
+	generation = (int) info.generation;
+	rngState = info.rngState != 0 ? info.rngState : 1;
+	for (unsigned int i=firstOwnedRow; i<=lastOwnedRow; i++)
+		rowChanged[i] = 1;
+	flushGridRows(nextGrid, firstOwnedRow, lastOwnedRow);
+	swapGrids();
+	return true;
+}
+
+//	Adds the pattern described by spec (file[@row,col]) to the grid, or
+//	replaces the grid with it.  Same constraints as resetGrid: the workers
+//	must be parked.
+bool placePattern(const char* spec, bool onEmptyGrid)
+{
+	char path[4096];
+	long row = numRows / 2, col = numCols / 2;
+	bool centered = true;
+	snprintf(path, sizeof(path), "%s", spec);
+	char* at = strrchr(path, '@');
+	if (at != NULL && sscanf(at + 1, "%ld,%ld", &row, &col) == 2) {
+		*at = '\0';
+		centered = false;
+	}
+
+	for (unsigned int i=firstOwnedRow; i<=lastOwnedRow; i++)
+	{
+		if (onEmptyGrid)
+			memset(nextGrid[i], 0, numCols * sizeof(unsigned int));
+		else
+			memcpy(nextGrid[i], currentGrid[i], numCols * sizeof(unsigned int));
+	}
+	PatternInfo info;
+	if (!loadPattern(path, nextGrid, firstOwnedRow, lastOwnedRow, numCols, row, col, centered, &info))
+		return false;
+	if (info.rule != 0)
+		rule = info.rule;
+	if (numSlabs == 1)
+		fprintf(stderr, "pattern %s: %lu cells, %lu within the grid\n", path, info.numCells, info.numPlaced);
+
+	for (unsigned int i=firstOwnedRow; i<=lastOwnedRow; i++)
+		rowChanged[i] = 1;
+	flushGridRows(nextGrid, firstOwnedRow, lastOwnedRow);
+	swapGrids();
+	return true;
+}
+
+//	Brings back a generation from the history.  Same constraints as
+//	resetGrid.
+bool rewindTo(int target)
+{
+	if (!historyActive() || !restoreHistory(target, nextGrid))
+		return false;
+	generation = target;
+	for (unsigned int i=firstOwnedRow; i<=lastOwnedRow; i++)
+		rowChanged[i] = 1;
+	flushGridRows(nextGrid, firstOwnedRow, lastOwnedRow);
+	swapGrids();
+	return true;
+}
+
+void clearGrid(void)
+{
+	for (unsigned int i=firstOwnedRow; i<=lastOwnedRow; i++)
+	{
+		memset(nextGrid[i], 0, numCols * sizeof(unsigned int));
+		rowChanged[i] = 1;
+	}
+	flushGridRows(nextGrid, firstOwnedRow, lastOwnedRow);
+	swapGrids();
+}
 
 void resetGrid(void)
 {
-	for (unsigned int i=0; i<numRows; i++)
+	for (unsigned int i=firstOwnedRow; i<=lastOwnedRow; i++)
 	{
 		for (unsigned int j=0; j<numCols; j++)
 		{
-			nextGrid[i][j] = rand() % 2;
+			nextGrid[i][j] = nextRandom() % 2;
 		}
+		rowChanged[i] = 1;
 	}
+	flushGridRows(nextGrid, firstOwnedRow, lastOwnedRow);
 	swapGrids();
 }
 
@@ -423,6 +1569,20 @@ void swapGrids(void)
 	unsigned int** tempGrid = currentGrid;
 	currentGrid = nextGrid;
 	nextGrid = tempGrid;
+	gridSwaps.fetch_add(1, std::memory_order_release);
+
+	//	Let the renderer know which rows of the new current grid differ
+	//	from the last ones it may have uploaded
+	gridChanged = false;
+	for (unsigned int i=firstOwnedRow; i<=lastOwnedRow; i++)
+	{
+		if (rowChanged[i])
+		{
+			gridChanged = true;
+			rowDirty[i].store(1, std::memory_order_release);
+			rowChanged[i] = 0;
+		}
+	}
 }
 
 
@@ -431,6 +1591,13 @@ void swapGrids(void)
 //	All three variants are used for simulations in research applications.
 //	I also refer explicitly to the S/B elements of the "rule" in place.
 unsigned int cellNewState(unsigned int i, unsigned int j)
+{
+	return cellNewStateIn(currentGrid, numRows, numCols, rule, i, j);
+}
+
+//	Same as cellNewState, for any grid and rule (used by the ensemble runner)
+unsigned int cellNewStateIn(unsigned int** grid, unsigned int nRows, unsigned int nCols,
+							unsigned int gridRule, unsigned int i, unsigned int j)
 {
 	//	First count the number of neighbors that are alive
 	//----------------------------------------------------
@@ -440,17 +1607,17 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 
 	//	Away from the border, we simply count how many among the cell's
 	//	eight neighbors are alive (cell state > 0)
-	if (i>0 && i<numRows-1 && j>0 && j<numCols-1)
+	if (i>0 && i<nRows-1 && j>0 && j<nCols-1)
 	{
 		//	remember that in C, (x == val) is either 1 or 0
-		count = (currentGrid[i-1][j-1] != 0) +
-				(currentGrid[i-1][j] != 0) +
-				(currentGrid[i-1][j+1] != 0)  +
-				(currentGrid[i][j-1] != 0)  +
-				(currentGrid[i][j+1] != 0)  +
-				(currentGrid[i+1][j-1] != 0)  +
-				(currentGrid[i+1][j] != 0)  +
-				(currentGrid[i+1][j+1] != 0);
+		count = (grid[i-1][j-1] != 0) +
+				(grid[i-1][j] != 0) +
+				(grid[i-1][j+1] != 0)  +
+				(grid[i][j-1] != 0)  +
+				(grid[i][j+1] != 0)  +
+				(grid[i+1][j-1] != 0)  +
+				(grid[i+1][j] != 0)  +
+				(grid[i+1][j+1] != 0);
 	}
 	//	on the border of the frame...
 	else
@@ -468,44 +1635,44 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 	
 			if (i>0)
 			{
-				if (j>0 && currentGrid[i-1][j-1] != 0)
+				if (j>0 && grid[i-1][j-1] != 0)
 					count++;
-				if (currentGrid[i-1][j] != 0)
+				if (grid[i-1][j] != 0)
 					count++;
-				if (j<NUM_COLS-1 && currentGrid[i-1][j+1] != 0)
+				if (j<nCols-1 && grid[i-1][j+1] != 0)
 					count++;
 			}
 
-			if (j>0 && currentGrid[i][j-1] != 0)
+			if (j>0 && grid[i][j-1] != 0)
 				count++;
-			if (j<NUM_COLS-1 && currentGrid[i][j+1] != 0)
+			if (j<nCols-1 && grid[i][j+1] != 0)
 				count++;
 
-			if (i<NUM_ROWS-1)
+			if (i<nRows-1)
 			{
-				if (j>0 && currentGrid[i+1][j-1] != 0)
+				if (j>0 && grid[i+1][j-1] != 0)
 					count++;
-				if (currentGrid[i+1][j] != 0)
+				if (grid[i+1][j] != 0)
 					count++;
-				if (j<NUM_COLS-1 && currentGrid[i+1][j+1] != 0)
+				if (j<nCols-1 && grid[i+1][j+1] != 0)
 					count++;
 			}
 			
 	
-		#elif FRAME_BEHAVIOR == FRAME_WRAPPED
+		#elif FRAME_BEHAVIOR == FRAME_WRAP
 	
-			unsigned int 	iM1 = (i+NUM_ROWS-1)%NUM_ROWS,
-							iP1 = (i+1)%NUM_ROWS,
-							jM1 = (j+NUM_COLS-1)%NUM_COLS,
-							jP1 = (j+1)%NUM_COLS;
-			count = currentGrid[iM1][jM1] != 0 +
-					currentGrid[iM1][j] != 0 +
-					currentGrid[iM1][jP1] != 0  +
-					currentGrid[i][jM1] != 0  +
-					currentGrid[i][jP1] != 0  +
-					currentGrid[iP1][jM1] != 0  +
-					currentGrid[iP1][j] != 0  +
-					currentGrid[iP1][jP1] != 0 ;
+			unsigned int 	iM1 = (i+nRows-1)%nRows,
+							iP1 = (i+1)%nRows,
+							jM1 = (j+nCols-1)%nCols,
+							jP1 = (j+1)%nCols;
+			count = (grid[iM1][jM1] != 0) +
+					(grid[iM1][j] != 0) +
+					(grid[iM1][jP1] != 0)  +
+					(grid[i][jM1] != 0)  +
+					(grid[i][jP1] != 0)  +
+					(grid[iP1][jM1] != 0)  +
+					(grid[iP1][j] != 0)  +
+					(grid[iP1][jP1] != 0);
 
 		#else
 			#error undefined frame behavior
@@ -520,13 +1687,13 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 	
 	//	unless....
 	
-	switch (rule)
+	switch (gridRule)
 	{
 		//	Rule 1 (Conway's classical Game of Life: B3/S23)
 		case GAME_OF_LIFE_RULE:
 
 			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid[i][j] != 0)
+			if (grid[i][j] != 0)
 			{
 				if (count == 3 || count == 2)
 					newState = 1;
@@ -543,7 +1710,7 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 		case CORAL_GROWTH_RULE:
 
 			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid[i][j] != 0)
+			if (grid[i][j] != 0)
 			{
 				if (count > 3)
 					newState = 1;
@@ -556,11 +1723,11 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 			}
 			break;
 			
-		//	Rule 3 (Amoeba: B357/S1358)
+		//	Rule 3 (Amoeba: B1358/S1358)
 		case AMOEBA_RULE:
 
 			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid[i][j] != 0)
+			if (grid[i][j] != 0)
 			{
 				if (count == 1 || count == 3 || count == 5 || count == 8)
 					newState = 1;
@@ -577,7 +1744,7 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 		case MAZE_RULE:
 
 			//	if the cell is currently occupied by a live cell, look at "Stay alive rule"
-			if (currentGrid[i][j] != 0)
+			if (grid[i][j] != 0)
 			{
 				if (count >= 1 && count <= 5)
 					newState = 1;
@@ -602,35 +1769,286 @@ unsigned int cellNewState(unsigned int i, unsigned int j)
 
 void createThreads(void) {
 	pthread_mutex_init(&threadCountLock, nullptr);
-	// initialize array of ThreadInfo structs
-	threadInfo = new ThreadInfo[maxNumThreads];
+	generationConfig = {rule, colorMode, speed};
+	// initialize array of ThreadInfo structs, with room to grow the pool later
+	unsigned int numOwnedRows = lastOwnedRow - firstOwnedRow + 1;
+	if (maxNumThreads > numOwnedRows)
+		maxNumThreads = numOwnedRows;
+	threadCapacity = maxNumThreads > MAX_NUM_THREADS ? maxNumThreads : MAX_NUM_THREADS;
+	threadInfo = new ThreadInfo[threadCapacity];
 	
-	unsigned int p = numRows / maxNumThreads;
-	unsigned int m = numRows % maxNumThreads; // threads with +1 load
-	unsigned int startRow = 0;
-	for (unsigned int k = 0; k < maxNumThreads; k++) {
+	for (unsigned int k = 0; k < threadCapacity; k++) {
 		threadInfo[k].index = k;
-		
+		threadInfo[k].bandTime = 0.;
+		threadInfo[k].lastBandTime = 0.;
+		threadInfo[k].bandRepeats = false;
+		threadInfo[k].population = 0;
+		threadInfo[k].computeNs = 0;
+		threadInfo[k].waitNs = 0;
+		threadInfo[k].cellsUpdated = 0;
+		for (unsigned int b = 0; b < METRIC_BUCKETS; b++)
+			threadInfo[k].waitTime.counts[b] = 0;
+		threadInfo[k].waitTime.sumNs = 0;
+
+		// Create the lock pre-locked. Don't think there's another way to do this.
+		pthread_mutex_init(&(threadInfo[k].lock), nullptr);
+		pthread_mutex_lock(&(threadInfo[k].lock));
+	}
+	assignBands();
+	spawnMissingThreads();
+
+	generationStart = currentTime();
+	//	reference sample for the first rates
+	sampleDashboard();
+	for (unsigned int k = 0; k < maxNumThreads; k++)
+		pthread_mutex_unlock(&(threadInfo[k].lock));
+}
+
+//	Splits the rows evenly between the maxNumThreads active workers
+void assignBands(void) {
+	unsigned int numOwnedRows = lastOwnedRow - firstOwnedRow + 1;
+	unsigned int p = numOwnedRows / maxNumThreads;
+	unsigned int m = numOwnedRows % maxNumThreads; // threads with +1 load
+	unsigned int startRow = firstOwnedRow;
+	for (unsigned int k = 0; k < maxNumThreads; k++) {
 		unsigned int endRow = k < m ? startRow + p : startRow + p - 1;
 
 		// Compute startRow, endRow
 		threadInfo[k].startRow = startRow;
 		threadInfo[k].endRow = endRow;
 		startRow = endRow + 1;
+	}
+}
 
-		// Create the lock pre-locked. Don't think there's another way to do this.
-		pthread_mutex_init(&(threadInfo[k].lock), nullptr);
-		pthread_mutex_lock(&(threadInfo[k].lock));
+//	The new worker waits on its (locked) lock until it is released with the
+//	others, so it never runs before the pool is settled
+bool spawnThread(unsigned int k) {
+	// create thread k
+	int error_code = pthread_create(&(threadInfo[k].id),	// ptr to pthread_t
+									nullptr, 				// thread attributes
+									threadFunc,				// thread function
+									&(threadInfo[k]));		// pointer to the data
+	if (error_code != 0) {
+		std::cerr << "ERROR: Failed to create ghost thread with error code " << error_code << std::endl;
+		return false;
 	}
+	numSpawnedThreads++;
+	return true;
+}
+
+//	Spawns the active workers that never ran.  If one can't be created, the
+//	pool shrinks to the workers that exist (the barrier would wait for the
+//	missing one forever), and the bands are split again between them.
+void spawnMissingThreads(void) {
+	for (unsigned int k = numSpawnedThreads; k < maxNumThreads; k++) {
+		if (!spawnThread(k)) {
+			if (k == 0) {
+				std::cerr << "ERROR: no worker thread could be created" << std::endl;
+				exit(1);
+			}
+			std::cerr << "ERROR: going on with " << k << " worker threads" << std::endl;
+			maxNumThreads = k;
+			assignBands();
+			for (unsigned int j = 0; j < threadCapacity; j++)
+				threadInfo[j].bandTime = threadInfo[j].lastBandTime = 0.;
+			break;
+		}
+	}
+	numLiveThreads = maxNumThreads;
+}
 
+//	Called by applyCommands.  The new size is applied by resizeThreadPool,
+//	at the same generation boundary.
+void requestNumThreads(unsigned int n) {
+	if (n < 1)
+		n = 1;
+	if (n > threadCapacity)
+		n = threadCapacity;
+	if (n > lastOwnedRow - firstOwnedRow + 1)
+		n = lastOwnedRow - firstOwnedRow + 1;
+	requestedNumThreads = n;
+}
+
+//	Can only be called by the last thread to finish a generation, while all
+//	the other workers are blocked on their lock.  Rebalances the bands for
+//	the new pool size, wakes up the workers that remain active (previously
+//	parked ones included) and spawns the ones that never ran yet.  Retired
+//	workers are simply not woken up.
+void resizeThreadPool(unsigned int selfIndex) {
+	unsigned int n = requestedNumThreads.exchange(0);
+	if (n != 0 && n != maxNumThreads) {
+		maxNumThreads = n;
+		assignBands();
+		// measurements for the old bands are meaningless now
+		for (unsigned int k = 0; k < threadCapacity; k++)
+			threadInfo[k].bandTime = threadInfo[k].lastBandTime = 0.;
+	}
+
+	// spawn the workers that never ran (they wait on their lock, like the
+	// parked ones), then wake up the other threads
+	spawnMissingThreads();
+	for (unsigned int k = 0; k < maxNumThreads; k++) {
+		if (k != selfIndex)
+			pthread_mutex_unlock(&(threadInfo[k].lock));
+	}
+}
+
+//	Can only be called by the last thread to finish a generation.
+//	Assumes that the cost of a row is uniform within a band and equal to
+//	the band's measured time divided by its number of rows, then moves the
+//	boundaries so that every worker gets the same share of the total cost.
+void rebalanceBands(void) {
+	double totalTime = 0., minTime = -1., maxTime = 0.;
+	for (unsigned int k = 0; k < maxNumThreads; k++) {
+		double t = threadInfo[k].bandTime;
+		threadInfo[k].lastBandTime = t / REBALANCE_PERIOD;
+		threadInfo[k].bandTime = 0.;
+		totalTime += t;
+		if (minTime < 0. || t < minTime)
+			minTime = t;
+		if (t > maxTime)
+			maxTime = t;
+	}
+
+	//	Hysteresis: leave the bands alone unless the imbalance is significant
+	if (totalTime <= 0. || maxTime - minTime < REBALANCE_THRESHOLD * totalTime / maxNumThreads)
+		return;
+
+	//	Per-row cost, according to the band each row currently belongs to
+	double* rowCost = new double[numRows];	//	only the owned rows are used
 	for (unsigned int k = 0; k < maxNumThreads; k++) {
-		// create thread k
-		int error_code = pthread_create(&(threadInfo[k].id),	// ptr to pthread_t
-										nullptr, 				// thread attributes
-										threadFunc,				// thread function
-										&(threadInfo[k]));		// pointer to the data
-		if (error_code < 0)
-			std::cerr << "ERROR: Failed to create ghost thread with error code " << error_code << std::endl;
-		else numLiveThreads++;  // increment counter to display on GUI
-	}
-}
\ No newline at end of file
+		unsigned int numBandRows = threadInfo[k].endRow - threadInfo[k].startRow + 1;
+		for (unsigned int i = threadInfo[k].startRow; i <= threadInfo[k].endRow; i++)
+			rowCost[i] = (REBALANCE_PERIOD * threadInfo[k].lastBandTime) / numBandRows;
+	}
+
+	//	Cut the rows wherever the cumulative cost crosses the next multiple
+	//	of the target, making sure that every worker keeps at least one row.
+	double target = totalTime / maxNumThreads;
+	double accumulated = 0.;
+	unsigned int k = 0, startRow = firstOwnedRow;
+	for (unsigned int i = firstOwnedRow; i <= lastOwnedRow && k < maxNumThreads - 1; i++) {
+		accumulated += rowCost[i];
+		unsigned int rowsLeft = lastOwnedRow - i;
+		unsigned int threadsLeft = maxNumThreads - k - 1;
+		if (accumulated >= target * (k + 1) || rowsLeft == threadsLeft) {
+			threadInfo[k].startRow = startRow;
+			threadInfo[k].endRow = i;
+			startRow = i + 1;
+			k++;
+		}
+	}
+	threadInfo[maxNumThreads - 1].startRow = startRow;
+	threadInfo[maxNumThreads - 1].endRow = lastOwnedRow;
+
+	delete []rowCost;
+}
+
+//	Monotonic wall clock time, in seconds
+double currentTime(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1.e-9 * t.tv_nsec;
+}
+
+//	Can only be called by the last thread to finish a generation, while all
+//	the others are parked.  Applies the queued commands, logging each one
+//	with the first generation it affects, then publishes the new settings.
+void applyCommands(void) {
+	Command command;
+	bool gridReplaced = false;
+	while (takeCommand(&command)) {
+		command.generation = generation + 1;
+		//	A slab can only replace its own rows, and the halos it already
+		//	received (two generations old once the grid is swapped) and the
+		//	rings of the neighbors would go out of step with them
+		if (numSlabs > 1 && (command.type == COMMAND_RESET || command.type == COMMAND_CLEAR ||
+							 command.type == COMMAND_PATTERN || command.type == COMMAND_SAVE ||
+							 command.type == COMMAND_LOAD)) {
+			fprintf(stderr, "generation %d: grid commands are not supported for multi-process runs\n", generation);
+			free(command.argument);
+			continue;
+		}
+		switch (command.type) {
+			case COMMAND_RULE:
+				rule = (unsigned int) command.value;
+				fprintf(stderr, "generation %d: rule %u\n", command.generation, rule);
+				break;
+			case COMMAND_COLOR:
+				colorMode = command.value < 0 ? !colorMode : (unsigned int) command.value;
+				fprintf(stderr, "generation %d: color %s\n", command.generation, colorMode ? "on" : "off");
+				break;
+			case COMMAND_FASTER:
+				speed = (speed * 9) / 10;
+				fprintf(stderr, "generation %d: speed %u\n", command.generation, speed);
+				break;
+			case COMMAND_SLOWER:
+				speed = (speed * 11) / 10;
+				fprintf(stderr, "generation %d: speed %u\n", command.generation, speed);
+				break;
+			case COMMAND_RESET:
+				resetGrid();
+				gridReplaced = true;
+				fprintf(stderr, "generation %d: reset\n", command.generation);
+				break;
+			case COMMAND_THREADS:
+			case COMMAND_ADD_THREADS: {
+				//	relative to the size already requested, if any
+				unsigned int pending = requestedNumThreads.load();
+				int n = command.type == COMMAND_THREADS ? command.value :
+						(int) (pending > 0 ? pending : maxNumThreads) + command.value;
+				requestNumThreads(n > 1 ? (unsigned int) n : 1);
+				fprintf(stderr, "generation %d: %u threads\n", command.generation, requestedNumThreads.load());
+				break;
+			}
+			//	the grid just computed is that of the current generation
+			case COMMAND_SAVE:
+				if (saveState(command.argument))
+					fprintf(stderr, "generation %d: saved %s\n", generation, command.argument);
+				break;
+			case COMMAND_LOAD:
+				if (restoreState(command.argument)) {
+					gridReplaced = true;
+					fprintf(stderr, "generation %d: loaded %s\n", generation, command.argument);
+				}
+				break;
+			case COMMAND_PATTERN:
+				if (placePattern(command.argument, false)) {
+					gridReplaced = true;
+					fprintf(stderr, "generation %d: pattern %s\n", command.generation, command.argument);
+				}
+				break;
+			case COMMAND_CLEAR:
+				clearGrid();
+				gridReplaced = true;
+				fprintf(stderr, "generation %d: clear\n", command.generation);
+				break;
+			case COMMAND_REWIND:
+			case COMMAND_SEEK: {
+				int target = command.type == COMMAND_SEEK ? command.value : generation - command.value;
+				int current = generation, oldest, newest;
+				if (rewindTo(target)) {
+					gridReplaced = true;
+					fprintf(stderr, "generation %d: back to generation %d\n", current, target);
+				}
+				else {
+					historyRange(&oldest, &newest);
+					fprintf(stderr, "generation %d: generation %d is not in the history (%d to %d)\n",
+							current, target, oldest, newest);
+				}
+				break;
+			}
+			default:
+				break;
+		}
+		free(command.argument);
+	}
+	if (gridReplaced) {
+		writeDeltaKeyframe(currentGrid, firstOwnedRow, lastOwnedRow, generation);
+		if (historyActive())
+			recordHistoryKeyframe(currentGrid, generation);
+		if (verifyActive())
+			resyncVerify(currentGrid);
+	}
+	generationConfig = {rule, colorMode, speed};
+}
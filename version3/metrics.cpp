@@ -0,0 +1,299 @@
+//
+//  metrics.cpp
+//  Cellular Automaton
+//
+//	The server is a thread of its own that answers one scrape at a time:
+//	it reads the request (HTTP/1.x, only GET /metrics is served), builds
+//	the text with collectMetrics and sends it with Connection: close.  A
+//	scraper that takes more than a second to send its request or read the
+//	reply is dropped.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+//
+#include "metrics.h"
+
+#define REQUEST_MAX			8192
+#define SCRAPE_TIMEOUT_MS	1000
+#define EXPORTED_BUCKETS	24	//	powers of two, from 1 µs to 8 s
+
+static int listenFd = -1, wakeFd[2] = {-1, -1};
+static char socketPath[108] = "";
+static pthread_t serverID;
+static bool serverRunning = false;
+
+static void* metricsServerFunc(void* arg);
+static void serveScrape(int fd);
+static bool sendAll(int fd, const char* data, size_t size);
+static void appendText(MetricsText* text, const char* format, ...);
+
+
+void observeMetric(MetricHistogram* histogram, double seconds)
+{
+	double us = 1.e6 * seconds;
+	int b = us >= 1. ? 1 + (int) (4. * log2(us)) : 0;
+	if (b >= METRIC_BUCKETS)
+		b = METRIC_BUCKETS - 1;
+	histogram->counts[b].fetch_add(1, std::memory_order_relaxed);
+	histogram->sumNs.fetch_add((unsigned long) (1.e9 * seconds), std::memory_order_relaxed);
+}
+
+
+double histogramPercentile(const unsigned long* counts, double q)
+{
+	unsigned long total = 0;
+	for (unsigned int b=0; b<METRIC_BUCKETS; b++)
+		total += counts[b];
+	if (total == 0)
+		return 0.;
+	unsigned long rank = (unsigned long) (q * (total - 1)), seen = 0;
+	unsigned int b = 0;
+	for ( ; b < METRIC_BUCKETS - 1; b++)
+	{
+		seen += counts[b];
+		if (seen > rank)
+			break;
+	}
+	return b > 0 ? pow(2., (b - 0.5) / 4.) : 0.5;
+}
+
+
+double histogramMax(const unsigned long* counts)
+{
+	for (int b=METRIC_BUCKETS-1; b>=0; b--)
+		if (counts[b] > 0)
+			return pow(2., b / 4.);
+	return 0.;
+}
+
+
+bool startMetricsServer(const char* address)
+{
+	char* end;
+	unsigned long port = strtoul(address, &end, 10);
+	if (*address != '\0' && *end == '\0')
+	{
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((unsigned short) port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		int on = 1;
+		if (listenFd >= 0)
+			setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (listenFd < 0 || bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listenFd, 8) < 0)
+		{
+			std::cerr << "ERROR: cannot serve metrics on port " << port << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+	}
+	else
+	{
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(address) >= sizeof(addr.sun_path))
+		{
+			std::cerr << "ERROR: socket path too long: " << address << std::endl;
+			return false;
+		}
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", address);
+		snprintf(socketPath, sizeof(socketPath), "%s", address);
+		unlink(address);
+		listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listenFd < 0 || bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listenFd, 8) < 0)
+		{
+			std::cerr << "ERROR: cannot serve metrics on " << address << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+	}
+
+	if (pipe(wakeFd) < 0 || pthread_create(&serverID, nullptr, metricsServerFunc, nullptr) != 0)
+	{
+		std::cerr << "ERROR: Failed to create the metrics thread" << std::endl;
+		return false;
+	}
+	serverRunning = true;
+	return true;
+}
+
+
+void stopMetricsServer(void)
+{
+	if (!serverRunning)
+		return;
+	char c = 0;
+	if (write(wakeFd[1], &c, 1) == 1)
+		pthread_join(serverID, nullptr);
+	close(listenFd);
+	if (socketPath[0] != '\0')
+		unlink(socketPath);
+	close(wakeFd[0]);
+	close(wakeFd[1]);
+	listenFd = wakeFd[0] = wakeFd[1] = -1;
+	serverRunning = false;
+}
+
+
+void metricHeader(MetricsText* text, const char* name, const char* type, const char* help)
+{
+	appendText(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+void metricValue(MetricsText* text, const char* name, const char* labels, double value)
+{
+	if (labels != nullptr)
+		appendText(text, "%s{%s} %.15g\n", name, labels, value);
+	else
+		appendText(text, "%s %.15g\n", name, value);
+}
+
+
+void metricHistogram(MetricsText* text, const char* name, const char* labels,
+					 const MetricHistogram* histogram)
+{
+	const char* separator = labels != nullptr ? "," : "";
+	if (labels == nullptr)
+		labels = "";
+	unsigned long counts[METRIC_BUCKETS], total = 0;
+	for (unsigned int b=0; b<METRIC_BUCKETS; b++)
+		total += counts[b] = histogram->counts[b].load(std::memory_order_relaxed);
+
+	//	bucket b ends at 2^(b/4) µs, so buckets 0 to 4k are within 2^k µs
+	unsigned long cumulative = 0;
+	unsigned int b = 0;
+	for (unsigned int k=0; k<EXPORTED_BUCKETS; k++)
+	{
+		for ( ; b <= 4*k; b++)
+			cumulative += counts[b];
+		appendText(text, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, separator, 1.e-6 * ldexp(1., k), cumulative);
+	}
+	appendText(text, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, separator, total);
+	appendText(text, "%s_sum%s%s%s %.9f\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+			   1.e-9 * histogram->sumNs.load(std::memory_order_relaxed));
+	appendText(text, "%s_count%s%s%s %lu\n", name, *labels ? "{" : "", labels, *labels ? "}" : "", total);
+}
+
+
+static void* metricsServerFunc(void* arg)
+{
+	(void) arg;
+	while (true)
+	{
+		struct pollfd fds[2] = {{listenFd, POLLIN, 0}, {wakeFd[0], POLLIN, 0}};
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents != 0)
+			break;
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (fd < 0)
+			continue;
+		struct timeval timeout = {SCRAPE_TIMEOUT_MS / 1000, 1000 * (SCRAPE_TIMEOUT_MS % 1000)};
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		serveScrape(fd);
+		close(fd);
+	}
+	return nullptr;
+}
+
+static void serveScrape(int fd)
+{
+	//	the request line and headers, up to the blank line
+	char request[REQUEST_MAX + 1];
+	size_t size = 0;
+	while (size < REQUEST_MAX)
+	{
+		ssize_t n = recv(fd, request + size, REQUEST_MAX - size, 0);
+		if (n <= 0)
+			return;
+		size += n;
+		request[size] = '\0';
+		if (strstr(request, "\r\n\r\n") != nullptr || strstr(request, "\n\n") != nullptr)
+			break;
+	}
+	request[size] = '\0';
+
+	char header[256];
+	if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET / ", 6) != 0)
+	{
+		const char* notFound = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		sendAll(fd, notFound, strlen(notFound));
+		return;
+	}
+
+	MetricsText text = {nullptr, 0, 0};
+	collectMetrics(&text);
+	int headerSize = snprintf(header, sizeof(header),
+							  "HTTP/1.1 200 OK\r\n"
+							  "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+							  "Content-Length: %zu\r\n"
+							  "Connection: close\r\n\r\n", text.size);
+	if (sendAll(fd, header, headerSize))
+		sendAll(fd, text.data, text.size);
+	free(text.data);
+}
+
+static bool sendAll(int fd, const char* data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void appendText(MetricsText* text, const char* format, ...)
+{
+	while (true)
+	{
+		va_list args;
+		va_start(args, format);
+		size_t room = text->capacity - text->size;
+		int n = vsnprintf(text->data != nullptr ? text->data + text->size : nullptr, room, format, args);
+		va_end(args);
+		if (n < 0)
+			return;
+		if ((size_t) n < room)
+		{
+			text->size += n;
+			return;
+		}
+		size_t capacity = text->capacity > 0 ? 2 * text->capacity : 16384;
+		while (capacity < text->size + n + 1)
+			capacity *= 2;
+		char* data = static_cast<char*>(realloc(text->data, capacity));
+		if (data == nullptr)
+			return;
+		text->data = data;
+		text->capacity = capacity;
+	}
+}
@@ -0,0 +1,60 @@
+//
+//  metrics.h
+//  Cellular Automaton
+//
+//	Metrics in the Prometheus text exposition format, served over HTTP on
+//	a local TCP port or a Unix domain socket.  The counters and histograms
+//	themselves live with the code they measure, each one written by a
+//	single thread (or with relaxed atomic adds), and the scrape only reads
+//	them: nothing is locked on the simulation side.
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+
+//	Bucket 0 counts the durations under 1 microsecond, bucket b those
+//	between 2^((b-1)/4) and 2^(b/4) microseconds, and the last one
+//	everything above.  The exposition folds them into buckets of whole
+//	powers of two.
+#define METRIC_BUCKETS		96
+
+typedef struct MetricHistogram {
+	std::atomic<unsigned long> counts[METRIC_BUCKETS];
+	std::atomic<unsigned long> sumNs;
+} MetricHistogram;
+
+//	Text of a scrape being built
+typedef struct MetricsText {
+	char* data;
+	size_t size, capacity;
+} MetricsText;
+
+void observeMetric(MetricHistogram* histogram, double seconds);
+
+//	Duration (in µs) below which a fraction q of the counts fall, taken at
+//	the geometric middle of the bucket (0.5 for bucket 0, under 1 µs), and
+//	upper bound of the highest non-empty bucket.  Both are 0 with no counts.
+double histogramPercentile(const unsigned long* counts, double q);
+double histogramMax(const unsigned long* counts);
+
+//	Starts the server thread.  address is a port number (bound to the
+//	loopback interface only) or the path of a Unix domain socket.
+//	Returns false on failure.
+bool startMetricsServer(const char* address);
+
+void stopMetricsServer(void);
+
+//	Implemented by the application: appends all its metrics to text
+void collectMetrics(MetricsText* text);
+
+//	For collectMetrics.  labels is either nullptr or the inside of the
+//	braces, e.g. thread="3".
+void metricHeader(MetricsText* text, const char* name, const char* type, const char* help);
+void metricValue(MetricsText* text, const char* name, const char* labels, double value);
+void metricHistogram(MetricsText* text, const char* name, const char* labels,
+					 const MetricHistogram* histogram);
+
+#endif // METRICS_H
@@ -0,0 +1,322 @@
+//
+//  pattern.cpp
+//  Cellular Automaton
+//
+//	The format is recognized from the first line: "#Life 1.06" for Life
+//	1.06, a '#' comment or an "x = " header for RLE, and anything else is
+//	taken as plaintext.  Only the RLE header and the comment lines are ever
+//	looked at as whole lines (and only their beginning is kept); cells are
+//	handled one character at a time.
+//
+//	The grid pane draws row 0 at the bottom, so the lines of a pattern go
+//	down the rows: line y of the file lands on row (origin row) - y, and the
+//	pattern looks the same as in any other Life program.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+//
+#include "gl_frontEnd.h"
+#include "pattern.h"
+
+#define PATTERN_BUFFER_SIZE	(1 << 16)
+#define PATTERN_LINE_MAX	1024
+
+using PatternReader = struct {
+	int fd;
+	unsigned char buffer[PATTERN_BUFFER_SIZE];
+	ssize_t size, position;
+};
+
+//	Where the cells go
+using PatternTarget = struct {
+	unsigned int** grid;
+	unsigned int firstRow, lastRow, numCols;
+	long row, col;
+	PatternInfo* info;
+};
+
+//	Birth and survival neighbor counts (bit n for n neighbors) of our rules
+using RuleMasks = struct {
+	unsigned int rule;
+	unsigned int birth, survival;
+};
+static const RuleMasks knownRules[] = {
+	{GAME_OF_LIFE_RULE,	1<<3,							(1<<2)|(1<<3)},
+	{CORAL_GROWTH_RULE,	1<<3,							(1<<4)|(1<<5)|(1<<6)|(1<<7)|(1<<8)},
+	{AMOEBA_RULE,		(1<<1)|(1<<3)|(1<<5)|(1<<8),	(1<<1)|(1<<3)|(1<<5)|(1<<8)},
+	{MAZE_RULE,			1<<3,							(1<<1)|(1<<2)|(1<<3)|(1<<4)|(1<<5)}
+};
+
+static int nextChar(PatternReader* in);
+static int peekChar(PatternReader* in);
+static unsigned int readLine(PatternReader* in, char* line);
+static void setCells(PatternTarget* target, long i, long j, unsigned long count);
+static void readRLE(PatternReader* in, PatternTarget* target, bool centered);
+static void readLife106(PatternReader* in, PatternTarget* target);
+static void readPlaintext(PatternReader* in, PatternTarget* target);
+static unsigned int parseRule(const char* str);
+
+
+bool loadPattern(const char* path, unsigned int** grid, unsigned int firstRow, unsigned int lastRow,
+				 unsigned int numCols, long row, long col, bool centered, PatternInfo* info)
+{
+	PatternReader* in = new PatternReader;
+	in->fd = open(path, O_RDONLY);
+	if (in->fd < 0)
+	{
+		std::cerr << "ERROR: cannot open pattern " << path << ": " << strerror(errno) << std::endl;
+		delete in;
+		return false;
+	}
+	in->size = in->position = 0;
+
+	PatternTarget target = {grid, firstRow, lastRow, numCols, row, col, info};
+	info->rule = 0;
+	info->numCells = info->numPlaced = 0;
+
+	int c = peekChar(in);
+	if (c == '#')
+	{
+		char line[PATTERN_LINE_MAX];
+		readLine(in, line);
+		if (!strncmp(line, "#Life 1.06", 10))
+			readLife106(in, &target);
+		else
+			readRLE(in, &target, centered);
+	}
+	else if (c == 'x')
+		readRLE(in, &target, centered);
+	else
+		readPlaintext(in, &target);
+
+	close(in->fd);
+	delete in;
+	return true;
+}
+
+
+//	The next character of the file, or -1 at the end
+static int nextChar(PatternReader* in)
+{
+	int c = peekChar(in);
+	if (c >= 0)
+		in->position++;
+	return c;
+}
+
+static int peekChar(PatternReader* in)
+{
+	if (in->position == in->size)
+	{
+		in->size = read(in->fd, in->buffer, PATTERN_BUFFER_SIZE);
+		in->position = 0;
+		if (in->size <= 0)
+		{
+			in->size = 0;
+			return -1;
+		}
+	}
+	return in->buffer[in->position];
+}
+
+//	Reads up to the end of the line, keeping its first PATTERN_LINE_MAX-1
+//	characters.  Returns the number of characters kept.
+static unsigned int readLine(PatternReader* in, char* line)
+{
+	unsigned int length = 0;
+	int c;
+	while ((c = nextChar(in)) >= 0 && c != '\n')
+		if (c != '\r' && length < PATTERN_LINE_MAX - 1)
+			line[length++] = (char) c;
+	line[length] = '\0';
+	return length;
+}
+
+//	Sets count live cells from (i, j) rightwards, in pattern coordinates
+//	(i is the line of the file, going down the grid)
+static void setCells(PatternTarget* target, long i, long j, unsigned long count)
+{
+	target->info->numCells += count;
+	i = target->row - i;
+	j += target->col;
+	if (i < (long) target->firstRow || i > (long) target->lastRow)
+		return;
+	long first = j < 0 ? 0 : j;
+	long end = j + (long) count < (long) target->numCols ? j + (long) count : (long) target->numCols;
+	unsigned int* gridRow = target->grid[i];
+	for (long k=first; k<end; k++)
+		gridRow[k] = 1;
+	if (end > first)
+		target->info->numPlaced += end - first;
+}
+
+static void readRLE(PatternReader* in, PatternTarget* target, bool centered)
+{
+	//	skip the comments, up to the header line
+	char line[PATTERN_LINE_MAX];
+	while (peekChar(in) == '#')
+		readLine(in, line);
+	readLine(in, line);
+
+	long width = 0, height = 0;
+	sscanf(line, " x = %ld , y = %ld", &width, &height);
+	const char* rule = strstr(line, "rule");
+	if (rule != nullptr)
+	{
+		rule = strchr(rule, '=');
+		if (rule != nullptr)
+		{
+			target->info->rule = parseRule(rule + 1);
+			if (target->info->rule == 0)
+				std::cerr << "Warning: rule" << rule + 1 << " of the pattern isn't one of ours, "
+						  << "it runs under the current rule" << std::endl;
+		}
+	}
+	if (centered)
+	{
+		target->row += height / 2;
+		target->col -= width / 2;
+	}
+
+	//	A run that goes past the grid and the pattern's offset from it ends
+	//	off the grid whatever its length, so the counts are capped there
+	//	rather than left to overflow
+	const unsigned long maxRun = (unsigned long) target->numCols + target->lastRow + 1
+								 + labs(target->row) + labs(target->col);
+	long i = 0, j = 0;
+	unsigned long count = 0;
+	int c;
+	while ((c = nextChar(in)) >= 0 && c != '!')
+	{
+		if (c >= '0' && c <= '9')
+		{
+			count = 10 * count + (c - '0');
+			if (count > maxRun)
+				count = maxRun;
+			continue;
+		}
+		unsigned long n = count > 0 ? count : 1;
+		count = 0;
+		if (c == 'b' || c == '.')
+			j += n;
+		else if (c == '$')
+		{
+			i += n;
+			j = 0;
+		}
+		//	any other letter is a live cell (multi-state RLE uses A to X)
+		else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+		{
+			setCells(target, i, j, n);
+			j += n;
+		}
+	}
+}
+
+static void readLife106(PatternReader* in, PatternTarget* target)
+{
+	//	numbers are read in place rather than line by line
+	long value[2];
+	int c = nextChar(in);
+	while (c >= 0)
+	{
+		if (c == '#')
+		{
+			while (c >= 0 && c != '\n')
+				c = nextChar(in);
+			continue;
+		}
+		int numValues = 0;
+		while (c >= 0 && c != '\n' && numValues < 2)
+		{
+			if (c == '-' || (c >= '0' && c <= '9'))
+			{
+				bool negative = c == '-';
+				long v = 0;
+				if (negative)
+					c = nextChar(in);
+				for ( ; c >= '0' && c <= '9'; c = nextChar(in))
+					v = 10 * v + (c - '0');
+				value[numValues++] = negative ? -v : v;
+			}
+			else
+				c = nextChar(in);
+		}
+		//	x is the column, y the row
+		if (numValues == 2)
+			setCells(target, value[1], value[0], 1);
+		while (c >= 0 && c != '\n')
+			c = nextChar(in);
+		c = nextChar(in);
+	}
+}
+
+static void readPlaintext(PatternReader* in, PatternTarget* target)
+{
+	long i = 0, j = 0;
+	bool lineStart = true;
+	int c;
+	while ((c = nextChar(in)) >= 0)
+	{
+		if (lineStart && c == '!')
+		{
+			while (c >= 0 && c != '\n')
+				c = nextChar(in);
+			continue;
+		}
+		lineStart = false;
+		if (c == '\n')
+		{
+			i++;
+			j = 0;
+			lineStart = true;
+		}
+		else if (c == 'O' || c == '*')
+			setCells(target, i, j++, 1);
+		else if (c != '\r')
+			j++;
+	}
+}
+
+//	Accepts B3/S23 and the older S/B notation (23/3).  Returns 0 for rules
+//	that we don't implement.
+static unsigned int parseRule(const char* str)
+{
+	unsigned int masks[2] = {0, 0};	//	birth, survival
+	int current = -1;
+	bool sbNotation = false;
+	for (const char* p = str; *p != '\0' && *p != ':' && *p != ','; p++)
+	{
+		if (*p == 'B' || *p == 'b')
+			current = 0;
+		else if (*p == 'S' || *p == 's')
+			current = 1;
+		else if (*p == '/')
+		{
+			//	"/3": S/B notation with no survival
+			if (current < 0)
+				sbNotation = true;
+			current = sbNotation ? 0 : current;
+		}
+		else if (*p >= '0' && *p <= '8')
+		{
+			if (current < 0)
+			{
+				//	digits before any letter: S/B notation
+				sbNotation = true;
+				current = 1;
+			}
+			masks[current] |= 1u << (*p - '0');
+		}
+	}
+	for (const RuleMasks& known : knownRules)
+		if (known.birth == masks[0] && known.survival == masks[1])
+			return known.rule;
+	return 0;
+}
@@ -0,0 +1,34 @@
+//
+//  pattern.h
+//  Cellular Automaton
+//
+//	Import of patterns in the usual formats of the Life community:
+//		- RLE ("x = 3, y = 3, rule = B3/S23" header, then runs such as 2bo$obo!),
+//		- Life 1.06 ("#Life 1.06", then one "x y" line per live cell),
+//		- plaintext ('.' and 'O' cells, '!' comment lines).
+//	The file is parsed as it is read, a buffer at a time, and live cells
+//	are written straight into the grid, so the size of the file doesn't
+//	matter.
+//
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+typedef struct PatternInfo {
+	//	rule found in an RLE header, if it is one of ours (0 otherwise)
+	unsigned int rule;
+	//	number of live cells read, and how many of those fell in the grid
+	unsigned long numCells, numPlaced;
+} PatternInfo;
+
+//	Sets the live cells of the pattern in grid, with the pattern's origin
+//	(top left corner as displayed, or (0, 0) for Life 1.06) at (row, col):
+//	row 0 is drawn at the bottom, so the pattern extends to lower rows.
+//	Only the rows firstRow to lastRow exist in grid; cells outside of them
+//	or of the numCols columns are dropped.  If centered is set, row and col are the
+//	center of the pattern instead (when the format gives its size).
+//	Returns false if the file can't be read.
+bool loadPattern(const char* path, unsigned int** grid, unsigned int firstRow, unsigned int lastRow,
+				 unsigned int numCols, long row, long col, bool centered, PatternInfo* info);
+
+#endif // PATTERN_H
@@ -0,0 +1,308 @@
+//
+//  perfCounters.cpp
+//  Cellular Automaton
+//
+//	The counters of a thread are read with a single read() of the group
+//	(a system call, a microsecond or so, twice per generation and worker).
+//	When there are more events than hardware counters, the kernel
+//	multiplexes them, and the values are scaled by the fraction of the time
+//	they were actually counted.
+//
+//	The per-phase sums of a thread are only added to by that thread; the
+//	totals are read from other threads with relaxed loads, and are only
+//	consistent when folded by the last worker of a generation (the others
+//	are parked then, the renderer doesn't matter much).
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <atomic>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+//
+#include "perfCounters.h"
+
+#define MAX_PERF_THREADS	512
+
+using PerfEventSpec = struct {
+	unsigned int type;
+	unsigned long config;
+	const char* name;
+};
+
+using PerfThread = struct {
+	int leaderFd;
+	unsigned int numOpen;
+	int event[PERF_NUM_EVENTS];			//	event of each value of a group read
+	double last[PERF_NUM_EVENTS];
+	bool started;
+	std::atomic<unsigned long> count[PERF_NUM_PHASES][PERF_NUM_EVENTS];
+};
+
+static const PerfEventSpec eventSpecs[PERF_NUM_EVENTS] = {
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"}};
+
+static const char* phaseNames[PERF_NUM_PHASES] = {"compute", "barrier", "render"};
+
+static bool perfEnabled = false;
+static bool available[PERF_NUM_EVENTS];
+
+static PerfThread* perfThreads[MAX_PERF_THREADS];
+static std::atomic<unsigned int> numPerfThreads(0);
+static pthread_mutex_t threadsLock = PTHREAD_MUTEX_INITIALIZER;
+static thread_local PerfThread* threadCounters = nullptr;
+
+//	Totals at the last fold, and the window that ended there
+static PerfTotals folded, window;
+static unsigned long lastFoldGeneration = 0;
+static pthread_mutex_t windowLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int openEvent(int event, int groupFd);
+static PerfThread* countersOfThread(void);
+static bool readGroup(PerfThread* counters, double* values);
+static void sumCounts(PerfTotals* totals);
+
+
+bool initPerfCounters(void)
+{
+	int firstError = 0;
+	unsigned int numAvailable = 0;
+	for (int e=0; e<PERF_NUM_EVENTS; e++)
+	{
+		int fd = openEvent(e, -1);
+		available[e] = fd >= 0;
+		if (fd >= 0)
+		{
+			close(fd);
+			numAvailable++;
+		}
+		else if (firstError == 0)
+			firstError = errno;
+	}
+	if (numAvailable == 0)
+	{
+		std::cerr << "Warning: no performance counters (" << strerror(firstError)
+				  << "), see /proc/sys/kernel/perf_event_paranoid" << std::endl;
+		return false;
+	}
+	for (int e=0; e<PERF_NUM_EVENTS; e++)
+		if (!available[e])
+			std::cerr << "Warning: " << eventSpecs[e].name << " can't be counted here" << std::endl;
+
+	memset(&folded, 0, sizeof(folded));
+	memset(&window, 0, sizeof(window));
+	perfEnabled = true;
+	return true;
+}
+
+
+bool perfCountersActive(void)
+{
+	return perfEnabled;
+}
+
+
+void perfPhaseStart(void)
+{
+	if (!perfEnabled)
+		return;
+	PerfThread* counters = countersOfThread();
+	if (counters != nullptr && readGroup(counters, counters->last))
+		counters->started = true;
+}
+
+
+void perfPhaseEnd(int phase)
+{
+	if (!perfEnabled)
+		return;
+	PerfThread* counters = countersOfThread();
+	double now[PERF_NUM_EVENTS];
+	if (counters == nullptr || !readGroup(counters, now))
+		return;
+	if (counters->started)
+	{
+		for (unsigned int k=0; k<counters->numOpen; k++)
+		{
+			int e = counters->event[k];
+			//	scaling can make a multiplexed count go back a little
+			if (now[e] > counters->last[e])
+				counters->count[phase][e].fetch_add((unsigned long) (now[e] - counters->last[e]),
+													std::memory_order_relaxed);
+		}
+	}
+	memcpy(counters->last, now, sizeof(now));
+	counters->started = true;
+}
+
+
+void foldPerfCounters(unsigned long generation)
+{
+	if (!perfEnabled)
+		return;
+	PerfTotals totals;
+	sumCounts(&totals);
+	pthread_mutex_lock(&windowLock);
+	for (int p=0; p<PERF_NUM_PHASES; p++)
+		for (int e=0; e<PERF_NUM_EVENTS; e++)
+			window.count[p][e] = totals.count[p][e] - folded.count[p][e];
+	window.generations = generation - lastFoldGeneration;
+	folded = totals;
+	lastFoldGeneration = generation;
+	pthread_mutex_unlock(&windowLock);
+}
+
+
+void perfWindow(PerfTotals* totals)
+{
+	pthread_mutex_lock(&windowLock);
+	*totals = window;
+	pthread_mutex_unlock(&windowLock);
+}
+
+
+void perfRunTotals(PerfTotals* totals, unsigned long generations)
+{
+	sumCounts(totals);
+	totals->generations = generations;
+}
+
+
+bool perfEventAvailable(int event)
+{
+	return perfEnabled && available[event];
+}
+
+
+const char* perfEventName(int event)
+{
+	return eventSpecs[event].name;
+}
+
+
+const char* perfPhaseName(int phase)
+{
+	return phaseNames[phase];
+}
+
+
+void formatPerfPhase(const PerfTotals* totals, int phase, char* text, size_t size)
+{
+	const double* c = totals->count[phase];
+	double generations = totals->generations > 0 ? (double) totals->generations : 1.;
+	size_t n = 0;
+	n += snprintf(text + n, size - n, "%s:", phaseNames[phase]);
+	if (n < size && available[PERF_TASK_CLOCK])
+		n += snprintf(text + n, size - n, " %.3f cpu-ms/gen", 1.e-6 * c[PERF_TASK_CLOCK] / generations);
+	bool counted = available[PERF_INSTRUCTIONS] && c[PERF_INSTRUCTIONS] > 0.;
+	if (n < size)
+	{
+		if (counted && available[PERF_CYCLES] && c[PERF_CYCLES] > 0.)
+			n += snprintf(text + n, size - n, " IPC %.2f", c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]);
+		else
+			n += snprintf(text + n, size - n, " IPC n/a");
+	}
+	//	misses per thousand instructions
+	const int misses[2] = {PERF_CACHE_MISSES, PERF_BRANCH_MISSES};
+	const char* labels[2] = {"LLC-MPKI", "branch-MPKI"};
+	for (int m=0; m<2 && n<size; m++)
+	{
+		if (counted && available[misses[m]])
+			n += snprintf(text + n, size - n, " %s %.2f", labels[m], 1000. * c[misses[m]] / c[PERF_INSTRUCTIONS]);
+		else
+			n += snprintf(text + n, size - n, " %s n/a", labels[m]);
+	}
+}
+
+
+//	User space only, so that perf_event_paranoid 2 (the usual default) is enough
+static int openEvent(int event, int groupFd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = eventSpecs[event].type;
+	attr.config = eventSpecs[event].config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	//	this thread only, on whatever CPU it runs
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+//	The group of a thread is opened on its first reading, and never closed
+static PerfThread* countersOfThread(void)
+{
+	if (threadCounters != nullptr)
+		return threadCounters;
+
+	PerfThread* counters = new PerfThread;
+	counters->leaderFd = -1;
+	counters->numOpen = 0;
+	counters->started = false;
+	for (int p=0; p<PERF_NUM_PHASES; p++)
+		for (int e=0; e<PERF_NUM_EVENTS; e++)
+			counters->count[p][e] = 0;
+	//	an event may still not fit in the group (not enough counters)
+	for (int e=0; e<PERF_NUM_EVENTS; e++)
+	{
+		if (!available[e])
+			continue;
+		int fd = openEvent(e, counters->leaderFd);
+		if (fd < 0)
+			continue;
+		if (counters->leaderFd < 0)
+			counters->leaderFd = fd;
+		counters->event[counters->numOpen++] = e;
+	}
+	if (counters->numOpen == 0)
+	{
+		delete counters;
+		return nullptr;
+	}
+
+	pthread_mutex_lock(&threadsLock);
+	unsigned int n = numPerfThreads.load(std::memory_order_relaxed);
+	if (n < MAX_PERF_THREADS)
+	{
+		perfThreads[n] = counters;
+		numPerfThreads.store(n + 1, std::memory_order_release);
+		threadCounters = counters;
+	}
+	pthread_mutex_unlock(&threadsLock);
+	return threadCounters;
+}
+
+static bool readGroup(PerfThread* counters, double* values)
+{
+	//	number of values, time enabled, time running, then the values
+	uint64_t buffer[3 + PERF_NUM_EVENTS];
+	ssize_t size = (ssize_t) ((3 + counters->numOpen) * sizeof(uint64_t));
+	if (read(counters->leaderFd, buffer, size) != size)
+		return false;
+	double scale = buffer[2] > 0 ? (double) buffer[1] / (double) buffer[2] : 0.;
+	for (int e=0; e<PERF_NUM_EVENTS; e++)
+		values[e] = 0.;
+	for (unsigned int k=0; k<counters->numOpen && k<buffer[0]; k++)
+		values[counters->event[k]] = scale * (double) buffer[3 + k];
+	return true;
+}
+
+static void sumCounts(PerfTotals* totals)
+{
+	memset(totals, 0, sizeof(*totals));
+	unsigned int n = numPerfThreads.load(std::memory_order_acquire);
+	for (unsigned int t=0; t<n; t++)
+		for (int p=0; p<PERF_NUM_PHASES; p++)
+			for (int e=0; e<PERF_NUM_EVENTS; e++)
+				totals->count[p][e] += (double) perfThreads[t]->count[p][e].load(std::memory_order_relaxed);
+}
@@ -0,0 +1,67 @@
+//
+//  perfCounters.h
+//  Cellular Automaton
+//
+//	Optional hardware performance counters (perf_event_open), per thread
+//	and per phase: band computation and barrier of the workers, rendering
+//	of the grid pane.  Each thread has one group of counters, read as a
+//	whole at the boundaries of its phases; what was counted since the
+//	previous reading goes to the phase that just ended.
+//
+//	Events that the machine doesn't count (e.g. in a virtual machine) are
+//	left out and shown as n/a.  If perf is not available at all
+//	(perf_event_paranoid, seccomp), initPerfCounters says so and returns
+//	false, and the other functions do nothing.
+//
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstddef>
+
+#define PERF_PHASE_COMPUTE	0
+#define PERF_PHASE_BARRIER	1	//	including the work of the last worker between generations
+#define PERF_PHASE_RENDER	2
+#define PERF_NUM_PHASES		3
+
+#define PERF_TASK_CLOCK		0	//	ns on a CPU
+#define PERF_CYCLES			1
+#define PERF_INSTRUCTIONS	2
+#define PERF_CACHE_MISSES	3	//	last level cache
+#define PERF_BRANCH_MISSES	4
+#define PERF_NUM_EVENTS		5
+
+//	Counts of all the threads, over some number of generations
+typedef struct PerfTotals {
+	double count[PERF_NUM_PHASES][PERF_NUM_EVENTS];
+	unsigned long generations;
+} PerfTotals;
+
+//	Finds out which events can be counted.  Returns false if none can.
+bool initPerfCounters(void);
+
+bool perfCountersActive(void);
+
+//	A phase of the calling thread starts, or ends.  Ending one starts the
+//	next (e.g. the end of a band is the start of the barrier), and the
+//	first call of a thread only starts counting.
+void perfPhaseStart(void);
+void perfPhaseEnd(int phase);
+
+//	Called every so many generations, while the workers are parked: the
+//	counts since the previous call become the current window
+void foldPerfCounters(unsigned long generation);
+
+//	The last complete window, and the totals since the start
+void perfWindow(PerfTotals* totals);
+void perfRunTotals(PerfTotals* totals, unsigned long generations);
+
+bool perfEventAvailable(int event);
+const char* perfEventName(int event);
+const char* perfPhaseName(int phase);
+
+//	One line per phase: CPU time per generation, instructions per cycle,
+//	and misses per thousand instructions
+void formatPerfPhase(const PerfTotals* totals, int phase, char* text, size_t size);
+
+#endif // PERF_COUNTERS_H
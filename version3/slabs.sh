@@ -0,0 +1,36 @@
+#!/bin/bash
+
+
+################## manual ###########################################
+# - launch script: "bash slabs.sh rows cols threadsPerProcess numProcesses generations [shm|socket]"
+# -
+# - splits the grid into numProcesses horizontal slabs, one cell process
+#   per slab, exchanging one-row halos at every generation
+# - each process prints the population of its slab and its throughput when done
+#
+#
+####################################################################
+
+if [ $# -lt 5 ]
+then
+	echo "usage: bash slabs.sh rows cols threadsPerProcess numProcesses generations [shm|socket]"
+	exit 1
+fi
+
+TRANSPORT=${6:-shm}
+# unique name so that concurrent runs don't share segments/sockets
+SESSION=$$
+
+# compile program (the slabs have no window)
+source "$(dirname "$0")/sources.sh"
+g++ -O2 -DHEADLESS $SOURCES -lm -lpthread -lrt -o $SOURCE_DIR/cell_headless
+if [ ! -f $SOURCE_DIR/cell_headless ]
+then
+	exit 1
+fi
+
+for (( k=0; k<$4; k++ ))
+do
+	$SOURCE_DIR/cell_headless $1 $2 $3 --slab $k $4 --generations $5 --transport $TRANSPORT --session $SESSION &
+done
+wait
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+
+################## manual ###########################################
+# - sourced by the scripts that build cell: "source sources.sh"
+# -
+# - SOURCE_DIR: this directory, as seen from the current one, so that the
+#   scripts work from anywhere
+# - SOURCES: the translation units of cell, under SOURCE_DIR, without
+#   gl_frontEnd.cpp, which only the windowed build adds
+# - a new source file is added here, and only here
+#
+#
+####################################################################
+
+SOURCE_DIR=$(dirname "${BASH_SOURCE[0]}")
+SOURCES=""
+for f in main.cpp halo.cpp ensemble.cpp frameExport.cpp control.cpp commands.cpp checkpoint.cpp pattern.cpp gridStore.cpp deltaStream.cpp history.cpp metrics.cpp trace.cpp verify.cpp perfCounters.cpp
+do
+	SOURCES="$SOURCES $SOURCE_DIR/$f"
+done
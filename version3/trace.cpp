@@ -0,0 +1,201 @@
+//
+//  trace.cpp
+//  Cellular Automaton
+//
+//	A ring is only written by its thread, which fills the slot of event
+//	number head, then publishes head+1 with a release store.  The dump
+//	reads head, copies the events still in the ring, then reads head again:
+//	the events that the thread may have overwritten in the meantime (the
+//	oldest ones) are discarded.  Events are recorded whole (begin and
+//	duration, "X" events in the JSON), so a ring never holds half of one.
+//
+//	The fields of an event are relaxed atomics, since the dump may read a
+//	slot while its thread overwrites it.  The thread puts a release fence
+//	between publishing head and overwriting a slot, and the dump an acquire
+//	fence between its copy and its second read of head: if the copy saw
+//	any part of event n, the second read returns more than n, and event n
+//	(whose slot was torn) is among the discarded ones.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <time.h>
+#include <pthread.h>
+//
+#include "trace.h"
+
+#define MAX_TRACE_RINGS	512
+
+using TraceEvent = struct {
+	std::atomic<const char*> name;	//	a string literal, never copied
+	std::atomic<double> start, end;
+	std::atomic<long> value;
+};
+
+//	What the dump copies out of a slot
+using TraceRecord = struct {
+	const char* name;
+	double start, end;
+	long value;
+};
+
+using TraceRing = struct {
+	char name[32];
+	TraceEvent* events;
+	std::atomic<unsigned long> head;	//	number of events ever recorded
+};
+
+static bool traceEnabled = false;
+static unsigned long ringSize = 0;
+static TraceRing* rings[MAX_TRACE_RINGS];
+static std::atomic<unsigned int> numRings(0);
+static pthread_mutex_t ringLock = PTHREAD_MUTEX_INITIALIZER;
+static thread_local TraceRing* threadRing = nullptr;
+
+static TraceRing* ringOfThread(void);
+static double now(void);
+
+
+bool initTrace(unsigned int eventsPerThread)
+{
+	ringSize = 1;
+	while (ringSize < eventsPerThread)
+		ringSize *= 2;
+	traceEnabled = true;
+	return true;
+}
+
+
+bool traceActive(void)
+{
+	return traceEnabled;
+}
+
+
+void traceThread(const char* name)
+{
+	if (!traceEnabled)
+		return;
+	TraceRing* ring = ringOfThread();
+	if (ring != nullptr)
+		snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+
+void traceEvent(const char* name, double start, double end, long value)
+{
+	if (!traceEnabled)
+		return;
+	TraceRing* ring = threadRing != nullptr ? threadRing : ringOfThread();
+	if (ring == nullptr)
+		return;
+	unsigned long head = ring->head.load(std::memory_order_relaxed);
+	TraceEvent* event = ring->events + (head & (ringSize - 1));
+	std::atomic_thread_fence(std::memory_order_release);
+	event->name.store(name, std::memory_order_relaxed);
+	event->start.store(start, std::memory_order_relaxed);
+	event->end.store(end, std::memory_order_relaxed);
+	event->value.store(value, std::memory_order_relaxed);
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+
+double traceSpan(const char* name, double start, long value)
+{
+	if (!traceEnabled)
+		return 0.;
+	double end = now();
+	traceEvent(name, start, end, value);
+	return end;
+}
+
+
+bool dumpTrace(const char* path, unsigned long* numEvents)
+{
+	*numEvents = 0;
+	if (!traceEnabled)
+		return false;
+	FILE* out = fopen(path, "w");
+	if (out == nullptr)
+	{
+		std::cerr << "ERROR: cannot write the trace to " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	TraceRecord* copy = new TraceRecord[ringSize];
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	unsigned int n = numRings.load(std::memory_order_acquire);
+	for (unsigned int r=0; r<n; r++)
+	{
+		TraceRing* ring = rings[r];
+		fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", r, ring->name);
+		first = false;
+
+		unsigned long head = ring->head.load(std::memory_order_acquire);
+		unsigned long oldest = head > ringSize ? head - ringSize : 0;
+		for (unsigned long k=oldest; k<head; k++)
+		{
+			const TraceEvent* event = ring->events + (k & (ringSize - 1));
+			TraceRecord* record = copy + (k - oldest);
+			record->name = event->name.load(std::memory_order_relaxed);
+			record->start = event->start.load(std::memory_order_relaxed);
+			record->end = event->end.load(std::memory_order_relaxed);
+			record->value = event->value.load(std::memory_order_relaxed);
+		}
+		//	what the thread overwrote while we were copying is unusable: with
+		//	newHead published, it may be writing event newHead, in the slot
+		//	of event newHead - ringSize
+		std::atomic_thread_fence(std::memory_order_acquire);
+		unsigned long newHead = ring->head.load(std::memory_order_relaxed);
+		unsigned long valid = newHead + 1 > ringSize ? newHead + 1 - ringSize : 0;
+
+		for (unsigned long k=oldest > valid ? oldest : valid; k<head; k++)
+		{
+			const TraceRecord* event = copy + (k - oldest);
+			fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+					event->name, r, 1.e6 * event->start, 1.e6 * (event->end - event->start));
+			if (event->value >= 0)
+				fprintf(out, ",\"args\":{\"value\":%ld}", event->value);
+			fprintf(out, "}");
+			(*numEvents)++;
+		}
+	}
+	fprintf(out, "\n]}\n");
+	delete []copy;
+	return fclose(out) == 0;
+}
+
+
+//	Rings are created on a thread's first event, and never freed
+static TraceRing* ringOfThread(void)
+{
+	if (threadRing != nullptr)
+		return threadRing;
+	pthread_mutex_lock(&ringLock);
+	unsigned int n = numRings.load(std::memory_order_relaxed);
+	if (n < MAX_TRACE_RINGS)
+	{
+		TraceRing* ring = new TraceRing;
+		snprintf(ring->name, sizeof(ring->name), "thread %u", n);
+		ring->events = new TraceEvent[ringSize];
+		ring->head = 0;
+		rings[n] = ring;
+		numRings.store(n + 1, std::memory_order_release);
+		threadRing = ring;
+	}
+	pthread_mutex_unlock(&ringLock);
+	return threadRing;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1.e-9 * t.tv_nsec;
+}
@@ -0,0 +1,39 @@
+//
+//  trace.h
+//  Cellular Automaton
+//
+//	Opt-in timeline of what each thread does (band computation, barrier
+//	wait, the leader's steps, rendering, commands), written as Chrome
+//	trace-event JSON (chrome://tracing, Perfetto) on demand.  Each thread
+//	records into a ring of its own, without locks; a ring keeps the last
+//	eventsPerThread events of its thread, so a run can be traced for as
+//	long as it lasts and the dump shows its most recent part.
+//
+//	Times are in seconds, as returned by currentTime().
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+//	Turns tracing on, with rings of eventsPerThread events (rounded up to
+//	a power of two).  Returns false on failure.
+bool initTrace(unsigned int eventsPerThread);
+
+bool traceActive(void);
+
+//	Names the calling thread in the dump (by default "thread N")
+void traceThread(const char* name);
+
+//	Records an event of the calling thread from start to end.  value is
+//	shown as the event's argument (e.g. the generation), if not negative.
+void traceEvent(const char* name, double start, double end, long value);
+
+//	Records an event from start to now and returns now, so that successive
+//	steps can be chained.  Does nothing (and returns 0) if tracing is off.
+double traceSpan(const char* name, double start, long value);
+
+//	Writes the events in the rings to path.  Can be called from any thread
+//	while the others keep recording.  Returns false on failure.
+bool dumpTrace(const char* path, unsigned long* numEvents);
+
+#endif // TRACE_H
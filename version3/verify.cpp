@@ -0,0 +1,135 @@
+//
+//  verify.cpp
+//  Cellular Automaton
+//
+//	The reference step below is the per-cell update of the workers
+//	(threadFunc in main.cpp), without any of their bookkeeping.  It is only
+//	ever called by the last worker of a generation, while the others are
+//	parked, so it needs no lock.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+//
+#include "gl_frontEnd.h"
+#include "verify.h"
+
+//	Differing cells listed in a mismatch report (all of them are counted)
+#define VERIFY_MAX_REPORTED	16
+
+//---------------------------------------------------------------------------
+//  Implemented in main.cpp
+//---------------------------------------------------------------------------
+
+unsigned int cellNewStateIn(unsigned int** grid, unsigned int nRows, unsigned int nCols,
+							unsigned int gridRule, unsigned int i, unsigned int j);
+
+static unsigned int** reference = nullptr;
+static unsigned int** scratch = nullptr;
+static unsigned int refRows = 0, refCols = 0;
+static unsigned long numVerified = 0;
+
+static void referenceGeneration(unsigned int rule, unsigned int colorMode);
+
+
+bool initVerify(unsigned int** grid, unsigned int numRows, unsigned int numCols)
+{
+	refRows = numRows;
+	refCols = numCols;
+	reference = new unsigned int*[numRows];
+	scratch = new unsigned int*[numRows];
+	for (unsigned int i=0; i<numRows; i++)
+	{
+		reference[i] = new unsigned int[numCols];
+		scratch[i] = new unsigned int[numCols];
+	}
+	resyncVerify(grid);
+	return true;
+}
+
+
+bool verifyActive(void)
+{
+	return reference != nullptr;
+}
+
+
+bool verifyGeneration(unsigned int** grid, int generation, unsigned int rule, unsigned int colorMode)
+{
+	referenceGeneration(rule, colorMode);
+
+	unsigned long numDiffering = 0;
+	for (unsigned int i=0; i<refRows; i++)
+	{
+		if (memcmp(grid[i], reference[i], refCols * sizeof(unsigned int)) == 0)
+			continue;
+		for (unsigned int j=0; j<refCols; j++)
+		{
+			if (grid[i][j] == reference[i][j])
+				continue;
+			if (numDiffering == 0)
+				std::cerr << "ERROR: generation " << generation << " differs from the reference (rule "
+						  << rule << ", color " << (colorMode ? "on" : "off") << ")" << std::endl;
+			if (numDiffering < VERIFY_MAX_REPORTED)
+				fprintf(stderr, "    row %u col %u: expected %u, got %u\n", i, j, reference[i][j], grid[i][j]);
+			numDiffering++;
+		}
+	}
+	if (numDiffering > 0)
+	{
+		if (numDiffering > VERIFY_MAX_REPORTED)
+			fprintf(stderr, "    ... %lu differing cells in all\n", numDiffering);
+		return false;
+	}
+	numVerified++;
+	return true;
+}
+
+
+void resyncVerify(unsigned int** grid)
+{
+	for (unsigned int i=0; i<refRows; i++)
+		memcpy(reference[i], grid[i], refCols * sizeof(unsigned int));
+}
+
+
+unsigned long verifiedGenerations(void)
+{
+	return numVerified;
+}
+
+
+void closeVerify(void)
+{
+	for (unsigned int i=0; reference != nullptr && i<refRows; i++)
+	{
+		delete []reference[i];
+		delete []scratch[i];
+	}
+	delete []reference;
+	delete []scratch;
+	reference = scratch = nullptr;
+}
+
+
+static void referenceGeneration(unsigned int rule, unsigned int colorMode)
+{
+	for (unsigned int i=0; i<refRows; i++)
+	{
+		for (unsigned int j=0; j<refCols; j++)
+		{
+			unsigned int newState = cellNewStateIn(reference, refRows, refCols, rule, i, j);
+			//	dead is dead in any mode, live cells age in color mode
+			if (colorMode == 0 || newState == 0)
+				scratch[i][j] = newState;
+			else if (reference[i][j] < NB_COLORS - 1)
+				scratch[i][j] = reference[i][j] + 1;
+			else
+				scratch[i][j] = reference[i][j];
+		}
+	}
+	unsigned int** temp = reference;
+	reference = scratch;
+	scratch = temp;
+}
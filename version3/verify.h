@@ -0,0 +1,34 @@
+//
+//  verify.h
+//  Cellular Automaton
+//
+//	Differential check of the engine: a shadow copy of the grid is advanced
+//	by the reference path (cellNewStateIn, one cell at a time on a single
+//	thread) and compared with the engine's grid after every generation.
+//	Any faster way of computing the generations must match it bit for bit.
+//
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+//	Copies the grid as the starting point of the reference.  Returns false
+//	on failure.
+bool initVerify(unsigned int** grid, unsigned int numRows, unsigned int numCols);
+
+bool verifyActive(void);
+
+//	Advances the reference by one generation, with the rule and color mode
+//	that the engine used, and compares it with grid (the engine's result
+//	for that generation).  On a mismatch, reports the differing cells and
+//	returns false.
+bool verifyGeneration(unsigned int** grid, int generation, unsigned int rule, unsigned int colorMode);
+
+//	Starts the reference over from grid, after a command replaced it
+void resyncVerify(unsigned int** grid);
+
+//	Number of generations checked so far
+unsigned long verifiedGenerations(void);
+
+void closeVerify(void);
+
+#endif // VERIFY_H
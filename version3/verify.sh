@@ -0,0 +1,83 @@
+#!/bin/bash
+
+
+################## manual ###########################################
+# - launch script: "bash verify.sh"
+# -
+# - builds cell_headless once per frame behavior (random borders can't be
+#   reproduced, so they are left out) and runs it with --verify, which
+#   checks every generation against the reference path, for every rule,
+#   on random soups (in black and white and in color) and known patterns,
+#   with several thread counts and with the grids in files
+# - stops at the first run with a mismatch, whose report lists the
+#   differing cells of the first generation that differs
+# - the reference calls the same cellNewStateIn as the engine, so this
+#   checks the banding, the threading and the out-of-core windows, not
+#   the rules themselves: a rule that cellNewStateIn gets wrong goes
+#   unnoticed
+# - the matrix can be changed through the environment, e.g.
+#     FRAMES="dead wrap" RULES="1 4" THREADS="1 2 5" GENERATIONS=10000
+#
+#
+####################################################################
+
+source "$(dirname "$0")/sources.sh"
+
+FRAMES=${FRAMES:-"dead clipped wrap"}
+RULES=${RULES:-"1 2 3 4"}
+THREADS=${THREADS:-"1 3"}
+GENERATIONS=${GENERATIONS:-2000}
+SEED=${SEED:-1}
+
+WORK=$(mktemp -d)
+trap "rm -rf $WORK" EXIT
+
+# known patterns: glider, R-pentomino, Gosper glider gun
+printf 'x = 3, y = 3\nbo$2bo$3o!\n' > $WORK/glider.rle
+printf 'x = 3, y = 3\nb2o$2o$bo!\n' > $WORK/rpentomino.rle
+printf 'x = 36, y = 9\n24bo$22bobo$12b2o6b2o12b2o$11bo3bo4b2o12b2o$2o8bo5bo3b2o$2o8bo3bob2o4bobo$10bo5bo7bo$11bo3bo$12b2o!\n' > $WORK/gun.rle
+
+frameNumber() {
+	case $1 in
+		dead) echo 0 ;;
+		clipped) echo 2 ;;
+		wrap) echo 3 ;;
+		*) echo "unknown frame behavior $1" >&2; exit 1 ;;
+	esac
+}
+
+runs=0
+for f in $FRAMES
+do
+	n=$(frameNumber $f) || exit 1
+	# compile program
+	g++ -O2 -DHEADLESS -DFRAME_BEHAVIOR=$n $SOURCES -lm -lpthread -lrt -o $WORK/cell-$f
+	if [ ! -f $WORK/cell-$f ]
+	then
+		exit 1
+	fi
+
+	for rule in $RULES
+	do
+		for t in $THREADS
+		do
+			# odd sizes, so that the bands are uneven; the gliders cross the edges
+			for start in "61 73" "61 73 --color" "96 120 --pattern $WORK/gun.rle@94,1 --pattern $WORK/glider.rle@90,110" \
+						 "80 80 --pattern $WORK/rpentomino.rle" "61 73 --backing-dir $WORK"
+			do
+				set -- $start
+				size="$1 $2"
+				shift 2
+				if ! $WORK/cell-$f $size $t --generations $GENERATIONS --rule $rule --seed $SEED --verify "$@" > $WORK/report 2>&1
+				then
+					cat $WORK/report
+					echo "MISMATCH: $f borders, rule $rule, $t threads, $size $*"
+					exit 1
+				fi
+				runs=$((runs + 1))
+			done
+		done
+	done
+	echo "$f borders: ok"
+done
+echo "$runs runs of $GENERATIONS generations match the reference"